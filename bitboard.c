@@ -0,0 +1,88 @@
+#include "bitboard.h"
+
+// One cell per row of a word, down a column / a diagonal / an anti-diagonal, from bit 0
+#define COLUMN_BITS 0x0001000100010001ULL
+#define DIAGONAL_BITS 0x0008000400020001ULL
+#define ANTI_DIAGONAL_BITS 0x0000200040008001ULL
+
+void bb_clear_all(Bitboard *bb) {
+    memset(bb, 0, sizeof(*bb));
+}
+
+// Bit i of the result is bit i + s of b, for 0 < s < 64: each word takes the low bits of the next one
+static inline uint64_t word_shr(const Bitset *b, int i, int s) {
+    return (b->w[i] >> s) | (i + 1 < BB_WORDS ? b->w[i + 1] << (64 - s) : 0);
+}
+
+// AND the bitset with itself shifted by s, then the pairs by 2s, then the fours by s:
+// a bit that survives starts five consecutive stones. Every shift stays under one word.
+static inline int has_five(const Bitset *b, int s) {
+    Bitset two, four;
+    for (int i = 0; i < BB_WORDS; i++) two.w[i] = b->w[i] & word_shr(b, i, s);
+    for (int i = 0; i < BB_WORDS; i++) four.w[i] = two.w[i] & word_shr(&two, i, 2 * s);
+    uint64_t five = 0;
+    for (int i = 0; i < BB_WORDS; i++) five |= four.w[i] & word_shr(&four, i, s);
+    return five != 0;
+}
+
+// Horizontal, vertical, diagonal and anti-diagonal runs
+int bs_has_five(const Bitset *b) {
+    return has_five(b, 1) || has_five(b, BB_STRIDE) || has_five(b, BB_STRIDE + 1) || has_five(b, BB_STRIDE - 1);
+}
+
+int bb_check_win(const Bitboard *bb, int colour) {
+    return bs_has_five(&bb->stones[colour - 1]);
+}
+
+// Bits that start five consecutive set bits of a line
+static inline unsigned line_fives(unsigned x) {
+    unsigned four = x & x >> 1;
+    four &= four >> 2;
+    return four & four >> 1;
+}
+
+static inline uint64_t rotate_right(uint64_t x, int n) { return x >> n | x << (-n & 63); }
+
+// Gather the four lines through (row, col) into small words, one bit per cell, and run the
+// shift-AND on each. The row is a slice of its word. The column and the diagonals are read
+// from the three words holding the nine rows centred on the move: each word is rotated so that
+// its cells of the line sit one per row at fixed bits, 4 bits apart from the other words',
+// and one multiply per line packs the twelve rows in order (the anti-diagonal in reverse).
+// Diagonal cells past the board's edge come out of a neighbouring row and are masked off.
+int bs_five_through(const Bitset *b, int row, int col) {
+    int top = row >> 2, first = 4 * top - 4;         // Rows first to first + 11 are read
+    int k = col - row, m = row + col;
+    uint64_t above = top ? b->w[top - 1] : 0, here = b->w[top], below = top < BB_WORDS - 1 ? b->w[top + 1] : 0;
+    int to_diagonal = (first + k) & 63, to_anti = (m - first - 8) & 63;
+    uint64_t column = (above >> col & COLUMN_BITS) | (here >> col & COLUMN_BITS) << 4
+                    | (below >> col & COLUMN_BITS) << 8;
+    uint64_t diagonal = (rotate_right(above, to_diagonal) & DIAGONAL_BITS)
+                      | (rotate_right(here, to_diagonal) & DIAGONAL_BITS << 4)
+                      | (rotate_right(below, to_diagonal) & DIAGONAL_BITS << 8);
+    uint64_t anti = (rotate_right(above, to_anti) & ANTI_DIAGONAL_BITS << 8)
+                  | (rotate_right(here, to_anti) & ANTI_DIAGONAL_BITS << 4)
+                  | (rotate_right(below, to_anti) & ANTI_DIAGONAL_BITS);
+    // Bit i of each line is row first + i, bit 11 - i on the anti-diagonal
+    unsigned vertical = (column * 0x0001000200040008ULL) >> 48 & 0xFFF;
+    unsigned down = (diagonal * 0x0001000100010001ULL) >> 48 & 0xFFF;
+    unsigned up = (anti * 0x0001000100010001ULL) >> 45 & 0xFFF;
+    down &= (0x7FFFULL << (22 - first - k)) >> 22;   // Rows where the diagonals are on the board
+    up &= (0x7FFFULL << (32 + first - m)) >> 21;
+    // Add the move and keep the nine cells centred on it: any five among them goes through it
+    int centre = row & 3;
+    unsigned horizontal = ((here >> centre * BB_STRIDE) | 1u << col) & (0x1FFu << col >> 4);
+    vertical = (vertical | 16u << centre) & 0x1FFu << centre;
+    down = (down | 16u << centre) & 0x1FFu << centre;
+    up = (up | 128u >> centre) & 0x1FFu << (3 - centre);
+    return (line_fives(horizontal) | line_fives(vertical) | line_fives(down) | line_fives(up)) != 0;
+}
+
+void bb_to_cells(const Bitboard *bb, int cells[BOARD_SIZE][BOARD_SIZE]) {
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        // Each row is a 16-bit slice of its word
+        int shift = (i & 3) * BB_STRIDE;
+        unsigned black = bb->stones[0].w[i >> 2] >> shift, white = bb->stones[1].w[i >> 2] >> shift;
+        for (int j = 0; j < BOARD_SIZE; j++)
+            cells[i][j] = ((black >> j) & 1) | (((white >> j) & 1) << 1);
+    }
+}
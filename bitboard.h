@@ -0,0 +1,98 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdint.h>
+#include "commun.h"
+
+// One bit per cell, rows use a 16-bit stride so four rows fit in each 64-bit word.
+// Column 15 of every row is never set: it stops horizontal and diagonal runs from
+// wrapping onto the next row when the bitset is shifted.
+#define BB_STRIDE 16
+#define BB_WORDS 4
+
+typedef struct {
+    uint64_t w[BB_WORDS];
+} Bitset;
+
+// Board as one bitset per colour: stones[0] holds black, stones[1] holds white
+typedef struct {
+    Bitset stones[2];
+} Bitboard;
+
+static inline int bb_index(int row, int col) { return row * BB_STRIDE + col; }
+
+static inline int bs_test(const Bitset *b, int index) {
+    return (b->w[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void bs_set(Bitset *b, int index) { b->w[index >> 6] |= 1ULL << (index & 63); }
+
+static inline void bs_clear(Bitset *b, int index) { b->w[index >> 6] &= ~(1ULL << (index & 63)); }
+
+// Colour of a cell: EMPTY, BLACK or WHITE
+static inline int bb_get(const Bitboard *bb, int row, int col) {
+    int i = bb_index(row, col);
+    return bs_test(&bb->stones[0], i) ? BLACK : bs_test(&bb->stones[1], i) ? WHITE : EMPTY;
+}
+
+static inline int bb_is_empty(const Bitboard *bb, int row, int col) {
+    int i = bb_index(row, col), word = i >> 6;
+    return !(((bb->stones[0].w[word] | bb->stones[1].w[word]) >> (i & 63)) & 1);
+}
+
+static inline void bb_place(Bitboard *bb, int row, int col, int colour) {
+    bs_set(&bb->stones[colour - 1], bb_index(row, col));
+}
+
+static inline void bb_remove(Bitboard *bb, int row, int col, int colour) {
+    bs_clear(&bb->stones[colour - 1], bb_index(row, col));
+}
+
+static inline int bs_count(const Bitset *b) {
+    return __builtin_popcountll(b->w[0]) + __builtin_popcountll(b->w[1])
+         + __builtin_popcountll(b->w[2]) + __builtin_popcountll(b->w[3]);
+}
+
+// Number of stones of one colour on the board
+static inline int bb_count(const Bitboard *bb, int colour) { return bs_count(&bb->stones[colour - 1]); }
+
+// Shift the whole bitset towards lower indices: bit i of the result is bit i + n of b
+static inline void bs_shr(const Bitset *b, int n, Bitset *out) {
+    int q = n >> 6, r = n & 63;
+    for (int i = 0; i < BB_WORDS; i++) {
+        uint64_t lo = i + q < BB_WORDS ? b->w[i + q] : 0;
+        uint64_t hi = i + q + 1 < BB_WORDS ? b->w[i + q + 1] : 0;
+        out->w[i] = r ? (lo >> r) | (hi << (64 - r)) : lo;
+    }
+}
+
+// Shift towards higher indices: bit i + n of the result is bit i of b
+static inline void bs_shl(const Bitset *b, int n, Bitset *out) {
+    int q = n >> 6, r = n & 63;
+    for (int i = BB_WORDS - 1; i >= 0; i--) {
+        uint64_t hi = i - q >= 0 ? b->w[i - q] : 0;
+        uint64_t lo = i - q - 1 >= 0 ? b->w[i - q - 1] : 0;
+        out->w[i] = r ? (hi << r) | (lo >> (64 - r)) : hi;
+    }
+}
+
+void bb_clear_all(Bitboard *bb);
+
+// 1 if the bitset holds a run of at least five stones in any of the four directions
+int bs_has_five(const Bitset *b);
+
+// 1 if the colour has five (or more) in a row anywhere on the board
+int bb_check_win(const Bitboard *bb, int colour);
+
+// 1 if the bitset, with (row, col) added, holds five in a row through (row, col)
+int bs_five_through(const Bitset *b, int row, int col);
+
+// 1 if placing colour at (row, col) makes five (or more) in a row
+static inline int bb_check_move(const Bitboard *bb, int row, int col, int colour) {
+    return bs_five_through(&bb->stones[colour - 1], row, col);
+}
+
+// Expand to one int per cell, the layout used by the protocol messages
+void bb_to_cells(const Bitboard *bb, int cells[BOARD_SIZE][BOARD_SIZE]);
+
+#endif
@@ -0,0 +1,420 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "protocol.h"
+#include "ring.h"
+#include "bitboard.h"
+
+#define MAX_EVENTS 256
+#define INBUF_SIZE 4096
+#define MAX_SCRIPT (BOARD_SIZE * BOARD_SIZE)
+
+// One headless player, or spectator: connection, what it knows of its game and its pending move
+typedef struct Bot {
+    int fd, connecting, my_player, current_player;
+    int spectator;                         // Watches the newest room instead of playing
+    int id;                                // Plays as "bot<id>", so it keeps a rating across games
+    Bitboard board;
+    Bitset forbidden;                      // Renju: cells the server refused since the last update
+    unsigned seq;
+    uint64_t connect_start, move_sent;     // Timestamps in ns, move_sent is 0 when no move is in flight
+    uint64_t move_due;                     // When the queued move may be played
+    unsigned move_id;                      // Request id of the last MOVE, quoted by REJECT
+    int move_row, move_col;
+    int queued, script_pos;
+    struct Bot *next_due;
+    Ring in;                               // Received bytes not yet forming a whole frame
+} Bot;
+
+// Growable array of latency samples in ns
+typedef struct {
+    uint64_t *v;
+    size_t n, cap;
+} Samples;
+
+// Load generator state
+typedef struct {
+    int epoll_fd, running;
+    struct sockaddr_in addr;
+    double rate;                           // Moves per second per connection, 0 plays as soon as possible
+    int renju;                             // Ask for Renju rooms
+    int script[MAX_SCRIPT][2], script_len;
+    Bot *due_head, *due_tail;              // Bots waiting for their think time, in due order
+    Samples connect_ns, rtt_ns;
+    long moves, games, connects, failures;
+    long spectator_updates;                // Boards and deltas received by the spectators
+} Bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_sample(Samples *s, uint64_t v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Value below which the given fraction of the (sorted) samples fall
+static double percentile(const Samples *s, double p) {
+    if (s->n == 0) return 0;
+    size_t i = (size_t)(p * (s->n - 1));
+    return s->v[i];
+}
+
+// Open a non-blocking connection; it completes when the socket becomes writable
+static void bot_connect(Bench *bench, Bot *bot) {
+    bot->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    bot->connecting = 1;
+    bot->my_player = bot->current_player = 0;
+    bot->move_sent = 0;
+    bot->seq = 0;
+    ring_reset(&bot->in);
+    bb_clear_all(&bot->board);
+    bot->connect_start = now_ns();
+    if (connect(bot->fd, (struct sockaddr *)&bench->addr, sizeof(bench->addr)) < 0 && errno != EINPROGRESS) {
+        perror("connect");
+        exit(1);
+    }
+    struct epoll_event ev = {EPOLLOUT, {.ptr = bot}};
+    epoll_ctl(bench->epoll_fd, EPOLL_CTL_ADD, bot->fd, &ev);
+}
+
+// Drop the connection and, while the benchmark runs, replace it with a new one
+static void bot_reconnect(Bench *bench, Bot *bot) {
+    epoll_ctl(bench->epoll_fd, EPOLL_CTL_DEL, bot->fd, NULL);
+    close(bot->fd);
+    bot->fd = -1;
+    if (bench->running) bot_connect(bench, bot);
+}
+
+// Pick the next scripted move that is still legal, or a random empty cell
+static int pick_move(Bench *bench, Bot *bot, int *row, int *col) {
+    while (bot->script_pos < bench->script_len) {
+        int *m = bench->script[bot->script_pos++];
+        if (bb_is_empty(&bot->board, m[0], m[1])) {
+            *row = m[0]; *col = m[1];
+            return 1;
+        }
+    }
+    if (bb_count(&bot->board, BLACK) + bb_count(&bot->board, WHITE) == CELL_COUNT) return 0;
+    int i = rand() % CELL_COUNT, tried = 0;
+    while (!bb_is_empty(&bot->board, i / BOARD_SIZE, i % BOARD_SIZE)
+           || bs_test(&bot->forbidden, bb_index(i / BOARD_SIZE, i % BOARD_SIZE))) {
+        // Only forbidden cells are left
+        if (++tried == CELL_COUNT) return 0;
+        i = (i + 1) % CELL_COUNT;
+    }
+    *row = i / BOARD_SIZE; *col = i % BOARD_SIZE;
+    return 1;
+}
+
+static void play_move(Bench *bench, Bot *bot) {
+    char buffer[32];
+    int row, col;
+    if (bot->fd < 0 || bot->connecting || bot->move_sent || bot->current_player != bot->my_player) return;
+    if (!pick_move(bench, bot, &row, &col)) {
+        bot_reconnect(bench, bot);
+        return;
+    }
+    sprintf(buffer, "MOVE %d %d %u", row, col, ++bot->move_id);
+    bot->move_row = row;
+    bot->move_col = col;
+    bot->move_sent = now_ns();
+    if (send_text(bot->fd, buffer) < 0) bot_reconnect(bench, bot);
+}
+
+// Our turn: move now, or after the think time when a rate is set
+static void schedule_move(Bench *bench, Bot *bot) {
+    if (bench->rate <= 0) {
+        play_move(bench, bot);
+        return;
+    }
+    if (bot->queued) return;
+    bot->queued = 1;
+    bot->move_due = now_ns() + (uint64_t)(1e9 / bench->rate);
+    bot->next_due = NULL;
+    if (bench->due_tail) bench->due_tail->next_due = bot;
+    else bench->due_head = bot;
+    bench->due_tail = bot;
+}
+
+// Play every queued move whose think time is over; return ms until the next one, -1 if none
+static int run_due(Bench *bench) {
+    uint64_t now = now_ns();
+    while (bench->due_head && bench->due_head->move_due <= now) {
+        Bot *bot = bench->due_head;
+        bench->due_head = bot->next_due;
+        if (!bench->due_head) bench->due_tail = NULL;
+        bot->queued = 0;
+        play_move(bench, bot);
+    }
+    if (!bench->due_head) return -1;
+    return (bench->due_head->move_due - now) / 1000000 + 1;
+}
+
+// An update arrived: a stone of our colour answers the move in flight, then maybe it is our turn.
+// Snapshots pass colour EMPTY.
+static void on_update(Bench *bench, Bot *bot, int colour) {
+    if (bot->spectator) {
+        bench->spectator_updates++;
+        return;
+    }
+    memset(&bot->forbidden, 0, sizeof(bot->forbidden));
+    if (bot->move_sent && colour == bot->my_player) {
+        add_sample(&bench->rtt_ns, now_ns() - bot->move_sent);
+        bot->move_sent = 0;
+        bench->moves++;
+    }
+    if (bot->current_player == bot->my_player) schedule_move(bench, bot);
+}
+
+// Handle one frame; text payloads are NUL-terminated. Text boards sent before PROTO
+// was handled match none of the cases and are skipped, the binary resend follows.
+static void handle_message(Bench *bench, Bot *bot, unsigned char *message, int len) {
+    BoardMsg board;
+    DeltaMsg delta;
+    unsigned id;
+    char reason[16];
+    char *text = (char *)message + FRAME_HEADER_SIZE;
+    if (message[2] == MSG_DELTA) {
+        if (decode_delta(message, len, &delta) < 0 || delta.seq <= bot->seq) return;
+        if (delta.seq != bot->seq + 1) {
+            send_text(bot->fd, "SYNC");
+            return;
+        }
+        bot->seq = delta.seq;
+        bb_place(&bot->board, delta.row, delta.col, delta.colour);
+        bot->current_player = delta.next_player;
+        on_update(bench, bot, delta.colour);
+    } else if (message[2] == MSG_BOARD) {
+        if (decode_board_binary(message, len, &board) < 0) return;
+        bb_clear_all(&bot->board);
+        for (int i = 0; i < BOARD_SIZE; i++)
+            for (int j = 0; j < BOARD_SIZE; j++)
+                if (board.board[i][j] != EMPTY) bb_place(&bot->board, i, j, board.board[i][j]);
+        // A fresh game starts the script again
+        if (bb_count(&bot->board, BLACK) + bb_count(&bot->board, WHITE) == 0) bot->script_pos = 0;
+        bot->seq = board.seq;
+        bot->current_player = board.current_player;
+        on_update(bench, bot, EMPTY);
+    } else if (message[2] != MSG_TEXT) {
+        return;
+    } else if (strncmp(text, "PLAYER", 6) == 0) {
+        bot->my_player = text[7] == '1' ? BLACK : WHITE;
+    } else if (strncmp(text, "VOTE", 4) == 0 && !bot->spectator) {
+        // Keep playing while the benchmark runs, the server then resets the board
+        if (bot->my_player == BLACK) bench->games++;
+        bot->move_sent = 0;
+        send_text(bot->fd, bench->running ? "VOTE y" : "VOTE n");
+    } else if (strncmp(text, "END", 3) == 0) {
+        bot_reconnect(bench, bot);
+    } else if (sscanf(text, "REJECT %u %15s", &id, reason) == 2 && id == bot->move_id && bot->move_sent) {
+        bot->move_sent = 0;
+        if (strcmp(reason, "FORBIDDEN") == 0) {
+            // Renju refused the move: pick another one
+            bs_set(&bot->forbidden, bb_index(bot->move_row, bot->move_col));
+            play_move(bench, bot);
+        } else if (strcmp(reason, "TIME") != 0) {
+            // Our board or turn was stale: the snapshot brings the next move
+            send_text(bot->fd, "SYNC");
+        }
+    }
+}
+
+static void handle_event(Bench *bench, Bot *bot) {
+    if (bot->connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(bot->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+            bench->failures++;
+            bot_reconnect(bench, bot);
+            return;
+        }
+        bot->connecting = 0;
+        bench->connects++;
+        add_sample(&bench->connect_ns, now_ns() - bot->connect_start);
+        struct epoll_event ev = {EPOLLIN, {.ptr = bot}};
+        epoll_ctl(bench->epoll_fd, EPOLL_CTL_MOD, bot->fd, &ev);
+        send_text(bot->fd, "PROTO 2");
+        if (bench->renju) send_text(bot->fd, "RULES RENJU");
+        char buffer[32];
+        sprintf(buffer, "PLAY bot%d", bot->id);
+        send_text(bot->fd, bot->spectator ? "WATCH" : buffer);
+        return;
+    }
+    int n = ring_read(&bot->in, bot->fd);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        bot_reconnect(bench, bot);
+        return;
+    }
+    unsigned char message[INBUF_SIZE + 1];
+    int len = 0;
+    // A message may make the bot reconnect, which resets the ring
+    while (!bot->connecting && bot->fd >= 0 && (len = ring_frame_length(&bot->in)) > 0) {
+        ring_take(&bot->in, message, len);
+        message[len] = '\0';
+        handle_message(bench, bot, message, len);
+    }
+    if (len < 0) bot_reconnect(bench, bot);
+}
+
+// Moves to replay, one "row col" pair per line
+static void load_script(Bench *bench, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    int row, col;
+    while (bench->script_len < MAX_SCRIPT && fscanf(f, "%d %d", &row, &col) == 2)
+        if (row >= 0 && row < BOARD_SIZE && col >= 0 && col < BOARD_SIZE) {
+            bench->script[bench->script_len][0] = row;
+            bench->script[bench->script_len][1] = col;
+            bench->script_len++;
+        }
+    fclose(f);
+}
+
+static void report(Bench *bench, int conns, int spectators, double seconds) {
+    qsort(bench->connect_ns.v, bench->connect_ns.n, sizeof(uint64_t), cmp_u64);
+    qsort(bench->rtt_ns.v, bench->rtt_ns.n, sizeof(uint64_t), cmp_u64);
+    printf("connections: %d, connects: %ld, failed: %ld, duration: %.1f s\n",
+           conns, bench->connects, bench->failures, seconds);
+    printf("moves: %ld (%.0f moves/s), games: %ld\n", bench->moves, bench->moves / seconds, bench->games);
+    printf("connect ms: p50 %.3f p99 %.3f p999 %.3f\n", percentile(&bench->connect_ns, 0.5) / 1e6,
+           percentile(&bench->connect_ns, 0.99) / 1e6, percentile(&bench->connect_ns, 0.999) / 1e6);
+    printf("move rtt us: p50 %.1f p99 %.1f p999 %.1f\n", percentile(&bench->rtt_ns, 0.5) / 1e3,
+           percentile(&bench->rtt_ns, 0.99) / 1e3, percentile(&bench->rtt_ns, 0.999) / 1e3);
+    if (spectators)
+        printf("spectators: %d, updates received: %ld (%.0f/s)\n", spectators, bench->spectator_updates,
+               bench->spectator_updates / seconds);
+}
+
+// The same results as one JSON object, for make bench
+static void report_json(Bench *bench, int conns, int spectators, double seconds) {
+    qsort(bench->connect_ns.v, bench->connect_ns.n, sizeof(uint64_t), cmp_u64);
+    qsort(bench->rtt_ns.v, bench->rtt_ns.n, sizeof(uint64_t), cmp_u64);
+    printf("{\"name\": \"loopback\", \"connections\": %d, \"spectators\": %d, \"seconds\": %.2f, "
+           "\"connects\": %ld, \"failures\": %ld, \"moves\": %ld, \"moves_per_s\": %.0f, \"games\": %ld,\n"
+           " \"move_rtt_ns\": {\"p50\": %.0f, \"p99\": %.0f, \"p999\": %.0f}, "
+           "\"connect_ns\": {\"p50\": %.0f, \"p99\": %.0f}}\n",
+           conns, spectators, seconds, bench->connects, bench->failures, bench->moves, bench->moves / seconds,
+           bench->games, percentile(&bench->rtt_ns, 0.5), percentile(&bench->rtt_ns, 0.99),
+           percentile(&bench->rtt_ns, 0.999), percentile(&bench->connect_ns, 0.5), percentile(&bench->connect_ns, 0.99));
+}
+
+// Ask the server for its own metrics on a separate connection and print them
+static void server_stats(struct sockaddr_in *addr) {
+    unsigned char frame[FRAME_HEADER_SIZE + 1024 + 1];
+    int fd = socket(AF_INET, SOCK_STREAM, 0), len = 0, total = FRAME_HEADER_SIZE;
+    if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 || send_text(fd, "STATS") < 0) {
+        perror("stats");
+        close(fd);
+        return;
+    }
+    while (len < total) {
+        int n = read(fd, frame + len, total - len);
+        if (n <= 0) break;
+        len += n;
+        if (len == FRAME_HEADER_SIZE) {
+            total = frame_length(frame);
+            if (total < 0 || total > (int)sizeof(frame) - 1) break;
+        }
+    }
+    close(fd);
+    if (len < total || total <= FRAME_HEADER_SIZE) return;
+    frame[total] = '\0';
+    printf("server:\n%s\n", (char *)frame + FRAME_HEADER_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+    int conns = 2, spectators = 0, stats = 0, json = 0, opt;
+    double duration = 10;
+    static Bench bench;
+    while ((opt = getopt(argc, argv, "n:s:r:d:f:RSJ")) != -1) {
+        switch (opt) {
+        case 'n': conns = atoi(optarg); break;
+        case 's': spectators = atoi(optarg); break;
+        case 'r': bench.rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'f': load_script(&bench, optarg); break;
+        case 'R': bench.renju = 1; break;
+        case 'S': stats = 1; break;
+        case 'J': json = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n connections] [-s spectators] [-r moves/s per connection] [-d seconds] [-f script] [-R] [-S] [-J] hostname\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind >= argc || conns < 1 || spectators < 0) {
+        fprintf(stderr, "Usage: %s [-n connections] [-s spectators] [-r moves/s per connection] [-d seconds] [-f script] [-R] [-S] [-J] hostname\n", argv[0]);
+        exit(1);
+    }
+    struct hostent *server = gethostbyname(argv[optind]);
+    if (!server) {
+        fprintf(stderr, "Unknown host %s\n", argv[optind]);
+        exit(1);
+    }
+    bench.addr.sin_family = AF_INET;
+    bench.addr.sin_port = htons(PORT);
+    memcpy(&bench.addr.sin_addr.s_addr, server->h_addr, server->h_length);
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    srand(time(NULL));
+
+    bench.epoll_fd = epoll_create1(0);
+    bench.running = 1;
+    // Spectators come last, so the players' rooms exist when they ask to watch
+    int total = conns + spectators;
+    Bot *bots = calloc(total, sizeof(Bot));
+    for (int i = 0; i < total; i++) {
+        ring_init(&bots[i].in, INBUF_SIZE);
+        bots[i].spectator = i >= conns;
+        bots[i].id = i;
+    }
+    uint64_t start = now_ns(), end = start + (uint64_t)(duration * 1e9);
+    for (int i = 0; i < total; i++) bot_connect(&bench, &bots[i]);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (now_ns() < end) {
+        int timeout = run_due(&bench);
+        int left = (end - now_ns()) / 1000000 + 1;
+        if (timeout < 0 || timeout > left) timeout = left;
+        int n = epoll_wait(bench.epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            Bot *bot = events[i].data.ptr;
+            if (bot->fd >= 0) handle_event(&bench, bot);
+        }
+    }
+    bench.running = 0;
+    if (json) report_json(&bench, conns, spectators, (now_ns() - start) / 1e9);
+    else report(&bench, conns, spectators, (now_ns() - start) / 1e9);
+    if (stats) server_stats(&bench.addr);
+    for (int i = 0; i < total; i++) {
+        if (bots[i].fd >= 0) close(bots[i].fd);
+        ring_free(&bots[i].in);
+    }
+    free(bots);
+    return 0;
+}
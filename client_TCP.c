@@ -1,20 +1,34 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
+#include <errno.h>
+#include <netinet/tcp.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#include "protocol.h"
+#include "ring.h"
+#include "log.h"
 
-#define BOARD_SIZE 15                      // Number of rows and columns on the board
 #define CELL_SIZE 40                       // Pixel size for each cell
 #define WINDOW_SIZE (BOARD_SIZE * CELL_SIZE + 100)  // Total window size
-#define EMPTY 0                            // Empty cell
-#define BLACK 1                            // Black stone
-#define WHITE 2                            // White stone
-#define PORT 12345                         // server port
+#define INBUF_SIZE 4096                    // Bytes received from the server and not yet handled
+#define STONE_RADIUS (CELL_SIZE / 3)
+// Cached text lines: status lines, then the vote panel
+#define TEXT_IDENTITY 0
+#define TEXT_TURN 1
+#define TEXT_SCORES 2
+#define TEXT_RESULT 3
+#define TEXT_PROMPT 4
+#define TEXT_YES 5
+#define TEXT_NO 6
+#define TEXT_CLOCKS 7
+#define TEXT_COUNT 8
+#define END_DELAY_MS 2000                  // Final scores stay on screen this long
+#define CLOCK_TICK_MS 1000                 // Redraw period of a running clock
+
+// Texture of a text line, rebuilt only when the text changes
+typedef struct {
+    char text[64];
+    SDL_Texture *texture;
+    int w, h;
+} TextCache;
 
 // Game UI structure, stores window, renderer, font, board state, etc.
 typedef struct {
@@ -25,10 +39,75 @@ typedef struct {
     int current_player, my_player, black_score, white_score;
     int player_count;                      // Number of players
     int move_state, from_row, from_col;      // Move state and starting position
+    unsigned seq;                          // Sequence number of the last update applied to the board
+    int syncing;                           // A snapshot was requested after a missed delta
+    SDL_Texture *grid;                     // Background and grid lines, drawn once
+    SDL_Texture *stones[2];                // Black and white stone discs, drawn once
+    TextCache texts[TEXT_COUNT];
+    int dirty;                             // Board or status changed since the last frame
+    int sockfd;
+    Uint32 net_event;                      // SDL event type posted by the network thread
+    Uint32 tick_event;                     // Posted every CLOCK_TICK_MS to count the running clock down
+    Clocks clocks;                         // From the last BOARD or DELTA
+    Uint32 clocks_at;                      // SDL_GetTicks() when they arrived
+    int voting;                            // 1 while asking for a vote, 2 once it is sent
+    int winner, vote_timeout;              // From the VOTE message
+    int ended;                             // END arrived: the server hanging up next is expected
+    int spectator;                         // Watching a room: no moves, no votes
+    int rating;                            // From the PLAYER message
+    // Our last move is drawn as soon as it is clicked, before the server's update confirms it
+    unsigned move_id;                      // Request id sent with the last MOVE
+    unsigned pending_id;                   // Id of the move waiting for its update, 0 if none
+    int pending_row, pending_col;
 } GameUI;
 
+// Free the cached textures (they are rebuilt by init_textures)
+void free_textures(GameUI *ui) {
+    if (ui->grid) SDL_DestroyTexture(ui->grid);
+    for (int i = 0; i < 2; i++)
+        if (ui->stones[i]) SDL_DestroyTexture(ui->stones[i]);
+    for (int i = 0; i < TEXT_COUNT; i++) {
+        if (ui->texts[i].texture) SDL_DestroyTexture(ui->texts[i].texture);
+        ui->texts[i].texture = NULL;
+        ui->texts[i].text[0] = '\0';
+    }
+    ui->grid = ui->stones[0] = ui->stones[1] = NULL;
+}
+
+// Render the static parts of the frame into textures: the grid and one disc per colour
+void init_textures(GameUI *ui) {
+    SDL_Renderer *renderer = ui->renderer;
+    ui->grid = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, WINDOW_SIZE, WINDOW_SIZE);
+    SDL_SetRenderTarget(renderer, ui->grid);
+    SDL_SetRenderDrawColor(renderer, 222, 184, 135, 255);
+    SDL_RenderClear(renderer);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        SDL_RenderDrawLine(renderer, 50, 50 + i * CELL_SIZE, 50 + (BOARD_SIZE - 1) * CELL_SIZE, 50 + i * CELL_SIZE);
+        SDL_RenderDrawLine(renderer, 50 + i * CELL_SIZE, 50, 50 + i * CELL_SIZE, 50 + (BOARD_SIZE - 1) * CELL_SIZE);
+    }
+    int r = STONE_RADIUS, size = 2 * r + 1;
+    for (int c = 0; c < 2; c++) {
+        ui->stones[c] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, size, size);
+        SDL_SetTextureBlendMode(ui->stones[c], SDL_BLENDMODE_BLEND);
+        SDL_SetRenderTarget(renderer, ui->stones[c]);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+        SDL_SetRenderDrawColor(renderer, c ? 255 : 0, c ? 255 : 0, c ? 255 : 0, 255);
+        // One horizontal span per row of the disc
+        for (int y = -r; y <= r; y++) {
+            int x = 0;
+            while ((x + 1) * (x + 1) + y * y <= r * r) x++;
+            SDL_RenderDrawLine(renderer, r - x, r + y, r + x, r + y);
+        }
+    }
+    SDL_SetRenderTarget(renderer, NULL);
+    ui->dirty = 1;
+}
+
 // Resource cleanup function
 void cleanup(GameUI *ui) {
+    free_textures(ui);
     if (ui->font) TTF_CloseFont(ui->font);
     if (ui->renderer) SDL_DestroyRenderer(ui->renderer);
     if (ui->window) SDL_DestroyWindow(ui->window);
@@ -38,41 +117,92 @@ void cleanup(GameUI *ui) {
 
 // Initialize SDL window, renderer, and font, set initial turn as black
 int init_ui(GameUI *ui) {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0 || TTF_Init() < 0) return 0;
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0 || TTF_Init() < 0) return 0;
     ui->window = SDL_CreateWindow("Gomoku", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
                                   WINDOW_SIZE, WINDOW_SIZE, SDL_WINDOW_SHOWN);
     if (!ui->window) return 0;
-    ui->renderer = SDL_CreateRenderer(ui->window, -1, SDL_RENDERER_ACCELERATED);
+    ui->renderer = SDL_CreateRenderer(ui->window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
     if (!ui->renderer) return 0;
+    init_textures(ui);
     ui->font = TTF_OpenFont("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", 18);
-    if (!ui->font) printf("Font not loaded\n");
+    if (!ui->font) log_error("Font not loaded");
     ui->move_state = 0;
     ui->current_player = BLACK;
     return 1;
 }
 
-// Draw the board, pieces, and status information
-void draw_board(GameUI *ui) {
-    SDL_SetRenderDrawColor(ui->renderer, 222, 184, 135, 255);
-    SDL_RenderClear(ui->renderer);
-    SDL_SetRenderDrawColor(ui->renderer, 0, 0, 0, 255);
+// Draw a text line, rendering its texture again only if the text changed
+void draw_text(GameUI *ui, TextCache *cache, const char *text, SDL_Color color, int x, int y) {
+    if (strcmp(cache->text, text) != 0 || !cache->texture) {
+        SDL_Surface *surface = TTF_RenderText_Solid(ui->font, text, color);
+        if (!surface) return;
+        if (cache->texture) SDL_DestroyTexture(cache->texture);
+        cache->texture = SDL_CreateTextureFromSurface(ui->renderer, surface);
+        cache->w = surface->w;
+        cache->h = surface->h;
+        SDL_FreeSurface(surface);
+        snprintf(cache->text, sizeof(cache->text), "%s", text);
+    }
+    SDL_Rect rect = {x, y, cache->w, cache->h};
+    SDL_RenderCopy(ui->renderer, cache->texture, NULL, &rect);
+}
 
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        SDL_RenderDrawLine(ui->renderer, 50, 50 + i * CELL_SIZE, 50 + (BOARD_SIZE - 1) * CELL_SIZE, 50 + i * CELL_SIZE);
-        SDL_RenderDrawLine(ui->renderer, 50 + i * CELL_SIZE, 50, 50 + i * CELL_SIZE, 50 + (BOARD_SIZE - 1) * CELL_SIZE);
+// One player's clock as m:ss, with the byo-yomi periods left; the player to move's runs from
+// the time the last update arrived
+void format_clock(GameUI *ui, int player, char *out) {
+    unsigned ms = ui->clocks.ms[player - 1];
+    Uint32 elapsed = SDL_GetTicks() - ui->clocks_at;
+    if (player == ui->current_player && !ui->voting) ms = ms > elapsed ? ms - elapsed : 0;
+    unsigned s = (ms + 999) / 1000;
+    int len = sprintf(out, "%s %u:%02u", player == BLACK ? "Black" : "White", s / 60, s % 60);
+    if (ui->clocks.periods[player - 1]) sprintf(out + len, " (%d)", ui->clocks.periods[player - 1]);
+}
+
+// Yes and No buttons of the vote panel
+SDL_Rect vote_button(int yes) {
+    SDL_Rect rect = {WINDOW_SIZE / 2 + (yes ? -110 : 30), WINDOW_SIZE / 2 + 15, 80, 34};
+    return rect;
+}
+
+// Panel shown at the end of a game: result, then the replay question or the wait for the opponent
+void draw_vote(GameUI *ui) {
+    SDL_Color black = {0, 0, 0, 255}, red = {200, 0, 0, 255};
+    SDL_Rect panel = {WINDOW_SIZE / 2 - 170, WINDOW_SIZE / 2 - 70, 340, 135};
+    char text[64];
+    SDL_SetRenderDrawColor(ui->renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(ui->renderer, &panel);
+    SDL_SetRenderDrawColor(ui->renderer, 0, 0, 0, 255);
+    SDL_RenderDrawRect(ui->renderer, &panel);
+    sprintf(text, "%s", ui->winner == BLACK ? "Black wins!" : ui->winner == WHITE ? "White wins!" : "Draw");
+    draw_text(ui, &ui->texts[TEXT_RESULT], text, red, panel.x + 20, panel.y + 12);
+    if (ui->voting == 2) {
+        draw_text(ui, &ui->texts[TEXT_PROMPT], ui->spectator ? "Waiting for the players' votes..." : "Waiting for the other vote...",
+                  black, panel.x + 20, panel.y + 45);
+        return;
     }
+    sprintf(text, "Play again? (y/n, %d s)", ui->vote_timeout);
+    draw_text(ui, &ui->texts[TEXT_PROMPT], text, black, panel.x + 20, panel.y + 45);
+    for (int yes = 0; yes < 2; yes++) {
+        SDL_Rect button = vote_button(yes);
+        SDL_RenderDrawRect(ui->renderer, &button);
+        draw_text(ui, &ui->texts[yes ? TEXT_YES : TEXT_NO], yes ? "Yes" : "No", black, button.x + 22, button.y + 6);
+    }
+}
 
+// Draw the board, pieces, and status information from the cached textures
+void draw_board(GameUI *ui) {
+    SDL_RenderCopy(ui->renderer, ui->grid, NULL, NULL);
+    int r = STONE_RADIUS;
     for (int i = 0; i < BOARD_SIZE; i++) {
         for (int j = 0; j < BOARD_SIZE; j++) {
             if (ui->board[i][j] != EMPTY) {
-                SDL_SetRenderDrawColor(ui->renderer, ui->board[i][j] == BLACK ? 0 : 255,
-                                       ui->board[i][j] == BLACK ? 0 : 255,
-                                       ui->board[i][j] == BLACK ? 0 : 255, 255);
-                int cx = 50 + j * CELL_SIZE, cy = 50 + i * CELL_SIZE, r = CELL_SIZE / 3;
-                for (int y = -r; y <= r; y++)
-                    for (int x = -r; x <= r; x++)
-                        if (x * x + y * y <= r * r)
-                            SDL_RenderDrawPoint(ui->renderer, cx + x, cy + y);
+                SDL_Rect rect = {50 + j * CELL_SIZE - r, 50 + i * CELL_SIZE - r, 2 * r + 1, 2 * r + 1};
+                SDL_Texture *stone = ui->stones[ui->board[i][j] == WHITE];
+                // A move the server has not confirmed yet is drawn faded
+                int pending = ui->pending_id && i == ui->pending_row && j == ui->pending_col;
+                if (pending) SDL_SetTextureAlphaMod(stone, 128);
+                SDL_RenderCopy(ui->renderer, stone, NULL, &rect);
+                if (pending) SDL_SetTextureAlphaMod(stone, 255);
             }
         }
     }
@@ -80,48 +210,213 @@ void draw_board(GameUI *ui) {
         SDL_Color color = {0, 0, 0, 255};
         char text[64];
         // Display player identity
-        sprintf(text, "You are: %s", ui->my_player == BLACK ? "Black" : "White");
-        SDL_Surface *surface = TTF_RenderText_Solid(ui->font, text, color);
-        if (surface) {
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(ui->renderer, surface);
-            SDL_Rect rect = {WINDOW_SIZE - 150, 10, surface->w, surface->h};
-            SDL_RenderCopy(ui->renderer, texture, NULL, &rect);
-            SDL_FreeSurface(surface);
-            SDL_DestroyTexture(texture);
-        }
+        if (ui->my_player) sprintf(text, "You are: %s (%d)", ui->my_player == BLACK ? "Black" : "White", ui->rating);
+        else sprintf(text, "You are: %s", ui->spectator ? "Spectator" : "-");
+        draw_text(ui, &ui->texts[TEXT_IDENTITY], text, color, WINDOW_SIZE - 220, 10);
         // Display current turn
-        sprintf(text, "Turn: %s", ui->current_player == BLACK ? "Black" : "White");
-        surface = TTF_RenderText_Solid(ui->font, text, color);
-        if (surface) {
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(ui->renderer, surface);
-            SDL_Rect rect = {10, 10, surface->w, surface->h}; // 放在棋盘顶部
-            SDL_RenderCopy(ui->renderer, texture, NULL, &rect);
-            SDL_FreeSurface(surface);
-            SDL_DestroyTexture(texture);
-        }
+        sprintf(text, "Turn: %s", ui->current_player == BLACK ? "Black" : ui->current_player == WHITE ? "White" : "-");
+        draw_text(ui, &ui->texts[TEXT_TURN], text, color, 10, 10); // 放在棋盘顶部
         // Display score information
         sprintf(text, "Scores: Black %d, White %d", ui->black_score, ui->white_score);
-        surface = TTF_RenderText_Solid(ui->font, text, color);
-        if (surface) {
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(ui->renderer, surface);
-            SDL_Rect rect = {10, WINDOW_SIZE - 30, surface->w, surface->h};
-            SDL_RenderCopy(ui->renderer, texture, NULL, &rect);
-            SDL_FreeSurface(surface);
-            SDL_DestroyTexture(texture);
+        draw_text(ui, &ui->texts[TEXT_SCORES], text, color, 10, WINDOW_SIZE - 30);
+        // Display both clocks in timed games
+        if (ui->clocks.ms[0] != NO_CLOCK) {
+            char black[32], white[32];
+            format_clock(ui, BLACK, black);
+            format_clock(ui, WHITE, white);
+            sprintf(text, "%s  %s", black, white);
+            draw_text(ui, &ui->texts[TEXT_CLOCKS], text, color, WINDOW_SIZE - 260, WINDOW_SIZE - 30);
         }
+        if (ui->voting) draw_vote(ui);
     }
     SDL_RenderPresent(ui->renderer);  // Update render content to the window
+    ui->dirty = 0;
+}
+
+// Show our move at once and send it with a new request id; the server's update confirms it
+// and a REJECT takes it back
+void play_pending(GameUI *ui, int row, int col) {
+    char buffer[48];
+    ui->pending_id = ++ui->move_id;
+    ui->pending_row = row;
+    ui->pending_col = col;
+    ui->board[row][col] = ui->my_player;
+    // Our clock stops here and the opponent's starts
+    Uint32 now = SDL_GetTicks(), elapsed = now - ui->clocks_at;
+    unsigned *ms = &ui->clocks.ms[ui->my_player - 1];
+    if (*ms != NO_CLOCK) *ms = *ms > elapsed ? *ms - elapsed : 0;
+    ui->clocks_at = now;
+    ui->current_player = ui->my_player == BLACK ? WHITE : BLACK;
+    ui->dirty = 1;
+    sprintf(buffer, "MOVE %d %d %u", row, col, ui->pending_id);
+    send_text(ui->sockfd, buffer);
+    log_debug("Sent MOVE %d %d", row, col);
+}
+
+// The server refused the pending move: the cell is empty again and the turn is still ours
+void rollback_pending(GameUI *ui) {
+    if (!ui->pending_id) return;
+    if (ui->board[ui->pending_row][ui->pending_col] == ui->my_player) ui->board[ui->pending_row][ui->pending_col] = EMPTY;
+    ui->current_player = ui->my_player;
+    ui->pending_id = 0;
+    ui->dirty = 1;
 }
 
 // Convert pixel coordinate to board row or column index
 int get_pos(int pixel) { return (pixel - 50 + CELL_SIZE / 2) / CELL_SIZE; }
 
+// Network thread: read the socket into a ring, cut it into complete frames and post each
+// one to the SDL event queue as a NUL-terminated copy. A NULL message reports the disconnect.
+int net_reader(void *arg) {
+    GameUI *ui = arg;
+    Ring in;
+    int len = 0;
+    ring_init(&in, INBUF_SIZE);
+    while (len >= 0 && ring_read(&in, ui->sockfd) > 0) {
+        while ((len = ring_frame_length(&in)) > 0) {
+            SDL_Event event = {0};
+            char *message = malloc(len + 1);
+            ring_take(&in, message, len);
+            message[len] = '\0';
+            event.type = ui->net_event;
+            event.user.code = len;
+            event.user.data1 = message;
+            SDL_PushEvent(&event);
+        }
+    }
+    // A stream that is not made of frames is treated like a disconnect
+    ring_free(&in);
+    SDL_Event event = {0};
+    event.type = ui->net_event;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+// Timer callback asking for a redraw while a clock runs
+Uint32 clock_timer(Uint32 interval, void *param) {
+    GameUI *ui = param;
+    SDL_Event event = {0};
+    event.type = ui->tick_event;
+    SDL_PushEvent(&event);
+    return interval;
+}
+
+// Timer callback ending the main loop once the final scores were shown
+Uint32 quit_timer(Uint32 interval, void *param) {
+    SDL_Event event = {0};
+    event.type = SDL_QUIT;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+// Handle one complete server frame; END schedules quit_timer, which ends the main loop
+void handle_message(GameUI *ui, char *message, int len) {
+    static int times = 0;
+    int type = (unsigned char)message[2];
+    char *text = message + FRAME_HEADER_SIZE;  // Payload of a text frame, NUL-terminated
+    BoardMsg board;
+    DeltaMsg delta;
+    if (type == MSG_TEXT && strncmp(text, "PLAYER", 6) == 0) {
+        // Identification, determine whether self is black or white
+        ui->my_player = text[7] == '1' ? BLACK : WHITE;
+        int room = 0;
+        unsigned token = 0;
+        sscanf(text + 8, "%d %d %u", &ui->rating, &room, &token);
+        log_text(LOG_INFO, ui->my_player == BLACK ? "BLACK" : "WHITE", "You are %s, rated %d, in room %d (resume token %u)",
+                 ui->rating, room, token);
+        ui->dirty = 1;
+    } else if (type == MSG_DELTA) {
+        // Handle DELTA message: apply it in order, ask for a snapshot on a gap
+        if (decode_delta((unsigned char *)message, len, &delta) < 0 || delta.seq <= ui->seq) return;
+        if (delta.seq != ui->seq + 1) {
+            if (!ui->syncing) send_text(ui->sockfd, "SYNC");
+            ui->syncing = 1;
+            return;
+        }
+        ui->board[delta.row][delta.col] = delta.colour;
+        ui->current_player = delta.next_player;
+        // The stone we already show is confirmed
+        if (ui->pending_id && delta.row == ui->pending_row && delta.col == ui->pending_col && delta.colour == ui->my_player)
+            ui->pending_id = 0;
+        ui->clocks = delta.clocks;
+        ui->clocks_at = SDL_GetTicks();
+        ui->seq = delta.seq;
+        ui->dirty = 1;
+    } else if (type == MSG_BOARD || (type == MSG_TEXT && strncmp(text, "BOARD", 5) == 0)) {
+        // Handle BOARD message, update board, current turn, state and scores
+        log_debug("Received board %d times;", ++times);
+        int ok = type == MSG_BOARD ? decode_board_binary((unsigned char *)message, len, &board)
+                                   : decode_board_text(text, len - FRAME_HEADER_SIZE, &board);
+        if (ok < 0) return;
+        memcpy(ui->board, board.board, sizeof(ui->board));
+        ui->current_player = board.current_player;
+        ui->move_state = board.move_state;
+        ui->black_score = board.black_score;
+        ui->white_score = board.white_score;
+        ui->clocks = board.clocks;
+        ui->clocks_at = SDL_GetTicks();
+        ui->seq = board.seq;
+        ui->syncing = 0;
+        ui->voting = 0;                    // A new game after the vote
+        ui->dirty = 1;
+        if (ui->pending_id) {
+            // A snapshot sent before our move was handled: keep showing the move while it is
+            // still ours to play, otherwise the snapshot settled it
+            int r = ui->pending_row, c = ui->pending_col;
+            if (ui->board[r][c] == EMPTY && ui->current_player == ui->my_player) {
+                ui->board[r][c] = ui->my_player;
+                ui->current_player = ui->my_player == BLACK ? WHITE : BLACK;
+            } else ui->pending_id = 0;
+        }
+    } else if (type == MSG_TEXT && strncmp(text, "VOTE", 4) == 0) {
+        // Handle VOTE message, show scores and winner, ask in the window whether to play again
+        log_debug("VOTE");
+        ui->vote_timeout = 0;
+        sscanf(text + 5, "%d %d %d %d", &ui->black_score, &ui->white_score, &ui->winner, &ui->vote_timeout);
+        if (ui->winner)
+            log_text(LOG_INFO, ui->winner == BLACK ? "BLACK" : "WHITE", "%s wins!");
+        ui->voting = ui->spectator ? 2 : 1;
+        ui->dirty = 1;
+    } else if (type == MSG_TEXT && strncmp(text, "REJECT", 6) == 0) {
+        // The server refused a move we already show: take it back
+        unsigned id = 0;
+        char reason[16] = "";
+        sscanf(text + 7, "%u %15s", &id, reason);
+        log_text(LOG_INFO, reason, "Move refused: %s");
+        if (id == ui->pending_id) rollback_pending(ui);
+    } else if (type == MSG_TEXT && strncmp(text, "FORBIDDEN", 9) == 0) {
+        // Renju refused the move (a server without REJECT): the turn is still ours
+        int row = -1, col = -1;
+        sscanf(text + 10, "%d %d", &row, &col);
+        log_info("Forbidden move %d %d", row, col);
+        rollback_pending(ui);
+    } else if (type == MSG_TEXT && strncmp(text, "END", 3) == 0) {
+        //  Handle END message, game ends, show final scores and quit after a short delay
+        log_info("Game ended");
+        sscanf(text + 4, "%d %d", &ui->black_score, &ui->white_score);
+        ui->voting = 0;
+        ui->ended = 1;
+        ui->dirty = 1;
+        SDL_AddTimer(END_DELAY_MS, quit_timer, NULL);
+    }
+}
+
+// Send the vote as a normal command; the panel then waits for the other player
+void send_vote(GameUI *ui, int yes) {
+    send_text(ui->sockfd, yes ? "VOTE y" : "VOTE n");
+    log_debug("Sending vote...");
+    ui->voting = 2;
+    ui->dirty = 1;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s hostname\n", argv[0]);
+        fprintf(stderr, "Usage: %s hostname [renju] [solo | watch [room] | resume room player | name]\n", argv[0]);
         exit(1);
     }
+    log_init();
     GameUI ui = {0};
+    ui.clocks.ms[0] = ui.clocks.ms[1] = NO_CLOCK;
     if (!init_ui(&ui)) { cleanup(&ui); return 1; }
 
     // Create socket and connect to server
@@ -130,111 +425,118 @@ int main(int argc, char *argv[]) {
     struct sockaddr_in serv_addr = {AF_INET, htons(PORT)};
     memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
     if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("Connect failed");
+        log_text(LOG_ERROR, strerror(errno), "Connect failed: %s");
         cleanup(&ui);
         exit(1);
     }
+    // Moves are tiny and latency-bound: do not let Nagle hold them back
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    ui.sockfd = sockfd;
 
     char buffer[1024];
-    // Read initial message from server, determine whether self is black or white
-    read(sockfd, buffer, sizeof(buffer));
-    ui.my_player = strncmp(buffer, "PLAYER 1", 8) == 0 ? BLACK : WHITE;
-    printf("You are %s\n", ui.my_player == BLACK ? "BLACK" : "WHITE");
+    // Ask for the binary board encoding; the server keeps the text one for older clients
+    send_text(sockfd, "PROTO 2");
+    // "solo": play against the server's engine instead of waiting for an opponent,
+    // "watch": follow a room (the newest one by default) without playing,
+    // "resume": take seat 1 or 2 back in a room the server recovered after a restart, with the
+    // token the PLAYER message gave for it,
+    // any other word: the name the server keeps the player's rating under.
+    // "renju" first plays by the Renju rules, against an opponent who asked for them too.
+    int arg = 2;
+    if (argc > arg && strcmp(argv[arg], "renju") == 0) {
+        send_text(sockfd, "RULES RENJU");
+        arg++;
+    }
+    if (argc > arg && strcmp(argv[arg], "solo") == 0) send_text(sockfd, "SOLO");
+    else if (argc > arg && strcmp(argv[arg], "watch") == 0) {
+        if (argc > arg + 1) sprintf(buffer, "WATCH %d", atoi(argv[arg + 1]));
+        else strcpy(buffer, "WATCH");
+        send_text(sockfd, buffer);
+        ui.spectator = 1;
+    } else if (argc > arg + 3 && strcmp(argv[arg], "resume") == 0) {
+        sprintf(buffer, "RESUME %d %d %lu", atoi(argv[arg + 1]), atoi(argv[arg + 2]), strtoul(argv[arg + 3], NULL, 10));
+        send_text(sockfd, buffer);
+    } else {
+        if (argc > arg) snprintf(buffer, sizeof(buffer), "PLAY %.15s", argv[arg]);
+        else strcpy(buffer, "PLAY");
+        send_text(sockfd, buffer);
+    }
     memset(ui.board, EMPTY, sizeof(ui.board));
     draw_board(&ui);
 
+    // Server messages arrive as SDL events, so the loop sleeps until there is input of either kind
+    ui.net_event = SDL_RegisterEvents(2);
+    ui.tick_event = ui.net_event + 1;
+    SDL_Thread *reader = SDL_CreateThread(net_reader, "net_reader", &ui);
+    SDL_AddTimer(CLOCK_TICK_MS, clock_timer, &ui);
+
     SDL_Event event;
     int running = 1;
-    int times = 0;
-    while (running) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT)
-                running = 0;
-            // On mouse click and it's your turn
-            if (event.type == SDL_MOUSEBUTTONDOWN && ui.current_player == ui.my_player) {
-                int row = get_pos(event.button.y), col = get_pos(event.button.x);
-                if (row >= 0 && row < BOARD_SIZE && col >= 0 && col < BOARD_SIZE) {
-                    if (ui.move_state == 0 && ui.board[row][col] == EMPTY) {
-                        // Send normal move message
-                        sprintf(buffer, "MOVE %d %d\n", row, col);
-                        write(sockfd, buffer, strlen(buffer));
-                        printf("Sent MOVE %d %d\n", row, col);
-                    } else if (ui.move_state == 1 && ui.board[row][col] == ui.my_player) {
-                        // Choose starting point, prepare to move piece
-                        ui.from_row = row; ui.from_col = col; ui.move_state = 2;
-                        draw_board(&ui);
-                    } else if (ui.move_state == 2 && ui.board[row][col] == EMPTY) {
-                        // Complete target move and send message
-                        sprintf(buffer, "MOVE_FROM %d %d MOVE_TO %d %d\n", ui.from_row, ui.from_col, row, col);
-                        write(sockfd, buffer, strlen(buffer));
-                        printf("Sent MOVE_FROM_TO: %s\n", buffer);
-                        ui.move_state = 0;
-                    }
-                }
+    while (running && SDL_WaitEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            running = 0;
+        if (event.type == ui.net_event) {
+            if (event.user.data1) {
+                handle_message(&ui, event.user.data1, event.user.code);
+                free(event.user.data1);
+            } else if (!ui.ended) {
+                log_info("Server disconnected");
+                break;
+            } else {
+                // The server hangs up right after END: keep the final scores up until quit_timer
+                ui.dirty = 1;
             }
         }
-        // Set socket read timeout and wait for server message
-        fd_set fds;
-        struct timeval tv = {0, 10000};
-        FD_ZERO(&fds);
-        FD_SET(sockfd, &fds);
-
-        if (select(sockfd + 1, &fds, NULL, NULL, &tv) > 0) {
-            memset(buffer, 0, sizeof(buffer));
-            // Read message from server
-            int n = read(sockfd, buffer, sizeof(buffer) - 1);
-            buffer[n] = '\0';
-            printf("Received message: %s\n", buffer);
-
-            // Split server message by newline
-            char *message = strtok(buffer, "\n");
-            while(message != NULL) {
-                if (n <= 0) {
-                    printf("Server disconnected\n");
-                    break;
-                }
-                printf("Handling message: %s\n", message);
-                if (strncmp(message, "BOARD", 5) == 0) {
-                    // Handle BOARD message, update board, current turn, state and scores
-                    printf("Received board %d times;\n", ++times);
-                    int pos = 6;
-                    sscanf(message + pos, "%d %d", &ui.current_player, &ui.move_state);
-                    while (message[pos] != ' ' && pos < n) pos++; pos++;
-                    while (message[pos] != ' ' && pos < n) pos++; pos++;
-                    for (int i = 0; i < BOARD_SIZE; i++)
-                        for (int j = 0; j < BOARD_SIZE; j++) {
-                            sscanf(message + pos, "%d", &ui.board[i][j]);
-                            while (message[pos] != ' ' && pos < n) pos++; pos++;
-                        }
-                    sscanf(message + pos, "%d %d", &ui.black_score, &ui.white_score);
-                    draw_board(&ui);
-                } else if (strncmp(message, "VOTE", 4) == 0) {
-                    // Handle VOTE message, show scores and winner, prompt user to play again
-                    printf("VOTE\n");
-                    int winner;
-                    sscanf(message + 5, "%d %d %d", &ui.black_score, &ui.white_score, &winner);
-                    draw_board(&ui);
-                    if (winner)
-                        printf("%s wins!\n", winner == BLACK ? "BLACK" : "WHITE");
-                    printf("Play again? (y/n): ");
-                    char vote;
-                    scanf(" %c", &vote);
-                    write(sockfd, &vote, 1);
-                    printf("Sending vote...\n");
-                } else if (strncmp(message, "END", 3) == 0) {
-                    //  Handle END message, game ends, show final scores and exit
-                    printf("Game ended\n");
-                    sscanf(message + 4, "%d %d", &ui.black_score, &ui.white_score);
-                    draw_board(&ui);
-                    SDL_Delay(2000);
-                    running = 0;
+        if (event.type == ui.tick_event && ui.clocks.ms[0] != NO_CLOCK && ui.current_player != EMPTY)
+            ui.dirty = 1;
+        // The window needs repainting, or the renderer lost the cached textures
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED)
+            ui.dirty = 1;
+        if (event.type == SDL_RENDER_TARGETS_RESET) {
+            free_textures(&ui);
+            init_textures(&ui);
+        }
+        // Vote with the keyboard or the panel's buttons
+        if (event.type == SDL_KEYDOWN && ui.voting == 1 &&
+            (event.key.keysym.sym == SDLK_y || event.key.keysym.sym == SDLK_n))
+            send_vote(&ui, event.key.keysym.sym == SDLK_y);
+        if (event.type == SDL_MOUSEBUTTONDOWN && ui.voting == 1) {
+            for (int yes = 0; yes < 2; yes++) {
+                SDL_Rect button = vote_button(yes);
+                if (event.button.x >= button.x && event.button.x < button.x + button.w &&
+                    event.button.y >= button.y && event.button.y < button.y + button.h)
+                    send_vote(&ui, yes);
+            }
+        }
+        // On mouse click and it's your turn
+        else if (event.type == SDL_MOUSEBUTTONDOWN && !ui.spectator && ui.current_player == ui.my_player) {
+            int row = get_pos(event.button.y), col = get_pos(event.button.x);
+            if (row >= 0 && row < BOARD_SIZE && col >= 0 && col < BOARD_SIZE) {
+                if (ui.move_state == 0 && ui.board[row][col] == EMPTY) {
+                    // Draw the move in this frame, without waiting for the round trip
+                    play_pending(&ui, row, col);
+                } else if (ui.move_state == 1 && ui.board[row][col] == ui.my_player) {
+                    // Choose starting point, prepare to move piece
+                    ui.from_row = row; ui.from_col = col; ui.move_state = 2;
+                    ui.dirty = 1;
+                } else if (ui.move_state == 2 && ui.board[row][col] == EMPTY) {
+                    // Complete target move and send message
+                    sprintf(buffer, "MOVE_FROM %d %d MOVE_TO %d %d", ui.from_row, ui.from_col, row, col);
+                    send_text(sockfd, buffer);
+                    log_text(LOG_DEBUG, buffer, "Sent MOVE_FROM_TO: %s");
+                    ui.move_state = 0;
                 }
-                // Handle next message
-                message = strtok(NULL, "\n");
             }
         }
-        SDL_Delay(10); 
+        // Redraw only when something changed, once the pending events are handled
+        if (ui.dirty && !SDL_PollEvent(NULL)) draw_board(&ui);
     }
+    // Wake the network thread up and free the messages it posted but nobody handled
+    shutdown(sockfd, SHUT_RDWR);
+    SDL_WaitThread(reader, NULL);
+    while (SDL_PollEvent(&event))
+        if (event.type == ui.net_event) free(event.user.data1);
     close(sockfd);
     cleanup(&ui);
     return 0;
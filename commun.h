@@ -1,7 +1,11 @@
 #ifndef COMMUN_H
 #define COMMUN_H
 
-#define PORT 12345
+#define PORT 12345      // Server port
+#define BOARD_SIZE 15   // Board size is 15x15
+#define EMPTY 0         // Empty cell
+#define BLACK 1         // Black stone
+#define WHITE 2         // White stone
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,4 +17,3 @@
 #include <arpa/inet.h>
 
 #endif
-
@@ -0,0 +1,314 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "engine.h"
+
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define TT_BITS 20                         // 1M entries of 16 bytes, shared by every search
+#define MAX_DEPTH 32
+#define MAX_MOVES 16                       // Best candidates searched at each node after ordering
+#define WIN_SCORE 1000000
+#define INF (WIN_SCORE + 1000)
+#define FIVE 100000                        // Threat score of a move that completes five
+
+#define TT_EXACT 0
+#define TT_LOWER 1
+#define TT_UPPER 2
+#define NO_MOVE 255
+
+// Lockless entry: check holds key ^ data, so a torn write by another thread fails the probe
+typedef struct {
+    uint64_t check, data;
+} TTEntry;
+
+// Position and statistics of one search thread
+typedef struct {
+    Bitboard bb;
+    uint64_t hash;
+    long nodes;
+    int id, best_move, best_score, best_depth;
+    struct Search *search;
+} Worker;
+
+// State shared by the threads of one search
+typedef struct Search {
+    atomic_int stop;
+    uint64_t deadline;
+    int colour;
+} Search;
+
+typedef struct {
+    int cell, score;
+} Candidate;
+
+// Candidate moves of a position, best first, with the threat totals used by the evaluation
+typedef struct {
+    Candidate moves[CELLS];
+    int n, own_total, opp_total, best_attack;
+} MoveList;
+
+static TTEntry *tt;
+static uint64_t zobrist[2][CELLS];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static const int dirs[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void engine_init(void) {
+    uint64_t seed = 0x5eed;
+    for (int c = 0; c < 2; c++)
+        for (int i = 0; i < CELLS; i++) zobrist[c][i] = splitmix64(&seed);
+    tt = calloc(1 << TT_BITS, sizeof(TTEntry));
+}
+
+static int tt_probe(uint64_t hash, uint64_t *data) {
+    TTEntry *e = &tt[hash & ((1 << TT_BITS) - 1)];
+    uint64_t check = __atomic_load_n(&e->check, __ATOMIC_RELAXED);
+    *data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+    return (check ^ *data) == hash;
+}
+
+static void tt_store(uint64_t hash, int score, int depth, int flag, int move) {
+    TTEntry *e = &tt[hash & ((1 << TT_BITS) - 1)];
+    uint64_t data = (uint32_t)score | (uint64_t)depth << 32 | (uint64_t)flag << 40 | (uint64_t)move << 48;
+    __atomic_store_n(&e->check, hash ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->data, data, __ATOMIC_RELAXED);
+}
+
+// Value of the line shape a stone at (row, col) would make, given its length and open ends
+static int shape_score(int count, int open) {
+    static const int table[5][3] = {
+        {0, 0, 0}, {0, 2, 10}, {0, 30, 200}, {0, 300, 3000}, {0, 5000, 20000}};
+    if (count >= 5) return FIVE;
+    return table[count][open];
+}
+
+// Threat made by `colour` playing the empty cell (row, col): sum of the four line shapes
+static int threat(const Bitboard *bb, int colour, int row, int col) {
+    const Bitset *own = &bb->stones[colour - 1];
+    int total = 0;
+    for (int d = 0; d < 4; d++) {
+        int count = 1, open = 0;
+        for (int side = -1; side <= 1; side += 2) {
+            int r = row, c = col;
+            while (1) {
+                r += side * dirs[d][0]; c += side * dirs[d][1];
+                if (r < 0 || r >= BOARD_SIZE || c < 0 || c >= BOARD_SIZE) break;
+                if (bs_test(own, bb_index(r, c))) { count++; continue; }
+                open += bb_is_empty(bb, r, c);
+                break;
+            }
+        }
+        total += shape_score(count, open);
+    }
+    return total;
+}
+
+// Empty cells within two steps of a stone, found by dilating the occupancy bitset
+static void near_cells(const Bitboard *bb, Bitset *out) {
+    static const int steps[4] = {1, BB_STRIDE - 1, BB_STRIDE, BB_STRIDE + 1};
+    Bitset occ, cur, t;
+    for (int i = 0; i < BB_WORDS; i++) occ.w[i] = cur.w[i] = bb->stones[0].w[i] | bb->stones[1].w[i];
+    for (int pass = 0; pass < 2; pass++) {
+        Bitset next = cur;
+        for (int s = 0; s < 4; s++) {
+            bs_shl(&cur, steps[s], &t);
+            for (int i = 0; i < BB_WORDS; i++) next.w[i] |= t.w[i];
+            bs_shr(&cur, steps[s], &t);
+            for (int i = 0; i < BB_WORDS; i++) next.w[i] |= t.w[i];
+        }
+        // Drop the guard column and the rows past the board before the next pass
+        for (int i = 0; i < BB_WORDS; i++) next.w[i] &= i < 3 ? 0x7fff7fff7fff7fffULL : 0x00007fff7fff7fffULL;
+        cur = next;
+    }
+    for (int i = 0; i < BB_WORDS; i++) out->w[i] = cur.w[i] & ~occ.w[i];
+}
+
+// Score every candidate move for `colour` (attack plus defence) and sort them, best first.
+// The summed threats of both sides make the static evaluation.
+static void gen_moves(const Bitboard *bb, int colour, MoveList *list) {
+    Bitset near;
+    Candidate *moves = list->moves;
+    int n = 0;
+    list->own_total = list->opp_total = list->best_attack = 0;
+    near_cells(bb, &near);
+    for (int w = 0; w < BB_WORDS; w++) {
+        uint64_t bits = near.w[w];
+        while (bits) {
+            int index = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            int row = index / BB_STRIDE, col = index % BB_STRIDE;
+            int attack = threat(bb, colour, row, col), defend = threat(bb, 3 - colour, row, col);
+            list->own_total += attack;
+            list->opp_total += defend;
+            if (attack > list->best_attack) list->best_attack = attack;
+            moves[n].cell = row * BOARD_SIZE + col;
+            moves[n].score = attack + attack / 8 + defend;
+            // Insertion sort, the lists are short
+            int i = n++;
+            while (i > 0 && moves[i - 1].score < moves[i].score) {
+                Candidate tmp = moves[i]; moves[i] = moves[i - 1]; moves[i - 1] = tmp;
+                i--;
+            }
+        }
+    }
+    list->n = n;
+}
+
+static inline void make_move(Worker *w, int cell, int colour) {
+    bb_place(&w->bb, cell / BOARD_SIZE, cell % BOARD_SIZE, colour);
+    w->hash ^= zobrist[colour - 1][cell];
+}
+
+static inline void undo_move(Worker *w, int cell, int colour) {
+    bb_remove(&w->bb, cell / BOARD_SIZE, cell % BOARD_SIZE, colour);
+    w->hash ^= zobrist[colour - 1][cell];
+}
+
+// Negamax alpha-beta from the point of view of `colour`, the side to move
+static int negamax(Worker *w, int colour, int depth, int alpha, int beta, int ply) {
+    Search *search = w->search;
+    if ((++w->nodes & 1023) == 0 && now_ns() > search->deadline) atomic_store(&search->stop, 1);
+    if (atomic_load_explicit(&search->stop, memory_order_relaxed)) return 0;
+
+    int alpha0 = alpha, tt_move = NO_MOVE;
+    uint64_t data;
+    if (tt_probe(w->hash, &data)) {
+        int score = (int32_t)(uint32_t)data, tt_depth = (data >> 32) & 0xff, flag = (data >> 40) & 3;
+        if (score > WIN_SCORE - 1000) score -= ply;
+        else if (score < -WIN_SCORE + 1000) score += ply;
+        tt_move = (data >> 48) & 0xff;
+        if (tt_depth >= depth && ply > 0) {
+            if (flag == TT_EXACT) return score;
+            if (flag == TT_LOWER && score >= beta) return score;
+            if (flag == TT_UPPER && score <= alpha) return score;
+        }
+    }
+
+    MoveList list;
+    Candidate *moves = list.moves;
+    gen_moves(&w->bb, colour, &list);
+    int n = list.n;
+    if (n == 0) return 0;                                  // Full board: draw
+    // Every cell that completes five is a candidate, so a win is seen before searching
+    if (list.best_attack >= FIVE) return WIN_SCORE - ply;
+    if (depth == 0) return list.own_total + list.own_total / 4 - list.opp_total;
+
+    // Search the transposition table move first
+    if (tt_move != NO_MOVE)
+        for (int i = 1; i < n; i++)
+            if (moves[i].cell == tt_move) {
+                Candidate tmp = moves[i];
+                memmove(moves + 1, moves, i * sizeof(Candidate));
+                moves[0] = tmp;
+                break;
+            }
+    if (n > MAX_MOVES) n = MAX_MOVES;
+
+    int best = -INF, best_move = moves[0].cell;
+    for (int i = 0; i < n; i++) {
+        make_move(w, moves[i].cell, colour);
+        int score = -negamax(w, 3 - colour, depth - 1, -beta, -alpha, ply + 1);
+        undo_move(w, moves[i].cell, colour);
+        if (atomic_load_explicit(&search->stop, memory_order_relaxed)) return 0;
+        if (score > best) {
+            best = score;
+            best_move = moves[i].cell;
+            if (ply == 0) w->best_move = best_move;
+        }
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) break;
+    }
+    int flag = best <= alpha0 ? TT_UPPER : best >= beta ? TT_LOWER : TT_EXACT;
+    int stored = best > WIN_SCORE - 1000 ? best + ply : best < -WIN_SCORE + 1000 ? best - ply : best;
+    tt_store(w->hash, stored, depth, flag, best_move);
+    return best;
+}
+
+// Iterative deepening. Helper threads start one ply deeper every other thread so that they
+// fill the shared table ahead of the main thread instead of repeating its work.
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Search *search = w->search;
+    int move = w->best_move;
+    for (int depth = 1 + (w->id & 1); depth <= MAX_DEPTH; depth++) {
+        int score = negamax(w, search->colour, depth, -INF, INF, 0);
+        if (atomic_load(&search->stop)) break;
+        move = w->best_move;
+        w->best_score = score;
+        w->best_depth = depth;
+        if (score > WIN_SCORE - 1000 || score < -WIN_SCORE + 1000) break;
+    }
+    w->best_move = move;
+    // The main thread finishing an iteration it cannot improve on ends the search
+    if (w->id == 0) atomic_store(&search->stop, 1);
+    return NULL;
+}
+
+void engine_search(const Bitboard *bb, int colour, int budget_ms, int threads, EngineResult *out) {
+    pthread_once(&init_once, engine_init);
+    MoveList list;
+    memset(out, 0, sizeof(*out));
+    if (bb_count(bb, BLACK) + bb_count(bb, WHITE) == 0) {
+        out->row = out->col = BOARD_SIZE / 2;
+        return;
+    }
+    gen_moves(bb, colour, &list);
+    if (list.n == 0) {
+        out->row = out->col = -1;
+        return;
+    }
+
+    Search search = {0};
+    search.deadline = now_ns() + (uint64_t)budget_ms * 1000000;
+    search.colour = colour;
+    if (threads < 1) threads = 1;
+    Worker *workers = calloc(threads, sizeof(Worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    for (int i = 0; i < threads; i++) {
+        Worker *w = &workers[i];
+        w->bb = *bb;
+        for (int c = 0; c < 2; c++)
+            for (int cell = 0; cell < CELLS; cell++)
+                if (bs_test(&bb->stones[c], bb_index(cell / BOARD_SIZE, cell % BOARD_SIZE))) w->hash ^= zobrist[c][cell];
+        w->id = i;
+        w->best_move = list.moves[0].cell;
+        w->search = &search;
+        if (i > 0) pthread_create(&tids[i], NULL, worker_main, w);
+    }
+    worker_main(&workers[0]);
+    for (int i = 1; i < threads; i++) pthread_join(tids[i], NULL);
+
+    // Deepest completed iteration wins, the main thread on ties
+    Worker *best = &workers[0];
+    for (int i = 0; i < threads; i++) {
+        out->nodes += workers[i].nodes;
+        if (workers[i].best_depth > best->best_depth) best = &workers[i];
+    }
+    out->row = best->best_move / BOARD_SIZE;
+    out->col = best->best_move % BOARD_SIZE;
+    out->score = best->best_score;
+    out->depth = best->best_depth;
+    free(workers);
+    free(tids);
+}
+
+int engine_candidates(const Bitboard *bb, int colour, int *cells, int max) {
+    MoveList list;
+    pthread_once(&init_once, engine_init);
+    gen_moves(bb, colour, &list);
+    int n = list.n < max ? list.n : max;
+    for (int i = 0; i < n; i++) cells[i] = list.moves[i].cell;
+    return n;
+}
@@ -0,0 +1,22 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "bitboard.h"
+
+// Outcome of a search: the move to play and how deep the search could look
+typedef struct {
+    int row, col;                          // -1 when the board is full
+    int score, depth;
+    long nodes;
+} EngineResult;
+
+// Iterative-deepening alpha-beta search for the best move of `colour`, stopped after budget_ms.
+// `threads` threads search the same position (lazy SMP) and share one Zobrist-keyed
+// transposition table. Reentrant: several searches may run at the same time.
+void engine_search(const Bitboard *bb, int colour, int budget_ms, int threads, EngineResult *out);
+
+// The cells (row * BOARD_SIZE + col) near the stones, in the order the search tries them for
+// `colour`, best first; return how many were stored, at most max
+int engine_candidates(const Bitboard *bb, int colour, int *cells, int max);
+
+#endif
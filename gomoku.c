@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include "gomoku.h"
+
+void game_init(Game *game, int rules) {
+    game->rules = rules;
+    game->renju = rules == RULES_RENJU ? malloc(sizeof(RenjuBoard)) : NULL;
+    game_reset(game);
+}
+
+void game_free(Game *game) {
+    free(game->renju);
+    game->renju = NULL;
+}
+
+void game_reset(Game *game) {
+    bb_clear_all(&game->board);
+    if (game->renju) renju_clear(game->renju);
+    game->current_player = BLACK;
+    game->moves = 0;
+}
+
+int game_check(const Game *game, int row, int col, int colour) {
+    if (row < 0 || row >= BOARD_SIZE || col < 0 || col >= BOARD_SIZE || (colour != BLACK && colour != WHITE)
+        || !bb_is_empty(&game->board, row, col))
+        return GAME_ILLEGAL;
+    // Renju judges black's shapes: exactly five wins, even where the move would otherwise be forbidden
+    if (game->renju && colour == BLACK) {
+        int verdict = renju_check(game->renju, row, col);
+        return verdict == RENJU_FIVE ? GAME_WIN : verdict == RENJU_FORBIDDEN ? GAME_FORBIDDEN : GAME_ONGOING;
+    }
+    // Only a line through the new stone can be new: shift-AND the four of them, bit-parallel
+    return bb_check_move(&game->board, row, col, colour) ? GAME_WIN : GAME_ONGOING;
+}
+
+int game_play(Game *game, int row, int col) {
+    int colour = game->current_player;
+    int result = game_check(game, row, col, colour);
+    if (result < 0) return result;
+    bb_place(&game->board, row, col, colour);
+    if (game->renju) renju_place(game->renju, row, col, colour);
+    game->moves++;
+    if (result == GAME_ONGOING && game->moves == BOARD_SIZE * BOARD_SIZE) result = GAME_DRAW;
+    game->current_player = result != GAME_ONGOING ? EMPTY : colour == BLACK ? WHITE : BLACK;
+    return result;
+}
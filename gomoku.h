@@ -0,0 +1,38 @@
+#ifndef GOMOKU_H
+#define GOMOKU_H
+
+#include "bitboard.h"
+#include "renju.h"
+
+// Outcome of a move
+#define GAME_ILLEGAL -2     // Off the board, on a stone, or nobody is to move
+#define GAME_FORBIDDEN -1   // Renju forbids the shape for black; the board is unchanged
+#define GAME_ONGOING 0
+#define GAME_WIN 1          // The player who moved wins
+#define GAME_DRAW 2         // The board is full
+
+// One game under one ruleset, owning nothing but its own memory: every function only touches
+// the Game it is given, so any number of games can be played from any number of threads
+typedef struct {
+    Bitboard board;
+    int rules;                             // RULES_FREESTYLE or RULES_RENJU
+    int current_player;                    // EMPTY once the game is over
+    int moves;
+    RenjuBoard *renju;                     // Line patterns of the board, Renju games only
+} Game;
+
+void game_init(Game *game, int rules);
+void game_free(Game *game);
+
+// Empty board, black to move
+void game_reset(Game *game);
+
+// What playing (row, col) would do for `colour`, without playing it: GAME_ILLEGAL,
+// GAME_FORBIDDEN, GAME_WIN or GAME_ONGOING (a move filling the board is not told apart)
+int game_check(const Game *game, int row, int col, int colour);
+
+// Play a move for the player to move and hand the turn over; return its outcome.
+// An illegal or forbidden move leaves the game as it was.
+int game_play(Game *game, int row, int col);
+
+#endif
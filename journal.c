@@ -0,0 +1,176 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "commun.h"
+#include "journal.h"
+#include "log.h"
+
+uint64_t journal_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Seeded so that a zero-filled record, such as a preallocated or torn tail, fails the check
+static uint8_t record_check(const JournalRecord *r) {
+    const uint8_t *p = (const uint8_t *)r;
+    uint8_t x = CHECK_SEED;
+    for (int i = 0; i < (int)sizeof(*r) - 1; i++) x ^= p[i];
+    return x;
+}
+
+// Number of the last segment in the directory, 0 if there is none
+static int last_segment(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    int last = 0, n;
+    char ext[8];
+    if (!d) return -1;
+    while ((e = readdir(d)))
+        if (sscanf(e->d_name, "%d.%7s", &n, ext) == 2 && strcmp(ext, "jnl") == 0 && n > last) last = n;
+    closedir(d);
+    return last;
+}
+
+static int open_segment(Journal *journal) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/%08d.jnl", journal->dir, ++journal->segment);
+    journal->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (journal->fd < 0) {
+        log_text(LOG_ERROR, strerror(errno), "Cannot open journal segment %d: %s", journal->segment);
+        return -1;
+    }
+    SegmentHeader header = {JOURNAL_MAGIC, JOURNAL_VERSION, journal->epoch_ms};
+    write(journal->fd, &header, sizeof(header));
+    journal->size = sizeof(header);
+    return 0;
+}
+
+static void *journal_writer(void *arg) {
+    Journal *journal = arg;
+    while (1) {
+        uint64_t count;
+        read(journal->wake_fd, &count, sizeof(count));
+        JournalBatch *batch = atomic_exchange_explicit(&journal->pending, NULL, memory_order_acquire), *fifo = NULL;
+        while (batch) {
+            JournalBatch *next = batch->next;
+            batch->next = fifo;
+            fifo = batch;
+            batch = next;
+        }
+        if (!fifo) continue;
+        for (batch = fifo; batch; batch = batch->next) {
+            size_t len = batch->count * sizeof(JournalRecord);
+            if (journal->size + len > SEGMENT_SIZE) {
+                fdatasync(journal->fd);
+                close(journal->fd);
+                if (open_segment(journal) < 0) exit(1);
+            }
+            if (write(journal->fd, batch->records, len) != (ssize_t)len) log_text(LOG_ERROR, strerror(errno), "journal write: %s");
+            journal->size += len;
+        }
+        // One sync commits every batch of the group, then their workers may send the replies
+        fdatasync(journal->fd);
+        while ((batch = fifo)) {
+            fifo = batch->next;
+            int done_fd = batch->done_fd;
+            free(batch);
+            if (done_fd >= 0) {
+                uint64_t one = 1;
+                write(done_fd, &one, sizeof(one));
+            }
+        }
+    }
+    return NULL;
+}
+
+int journal_open(Journal *journal, const char *dir) {
+    snprintf(journal->dir, sizeof(journal->dir), "%s", dir);
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        log_text(LOG_ERROR, strerror(errno), "Cannot create the journal directory: %s");
+        return -1;
+    }
+    journal->segment = last_segment(dir);
+    if (journal->segment < 0) {
+        log_text(LOG_ERROR, strerror(errno), "Cannot read the journal directory: %s");
+        return -1;
+    }
+    journal->epoch_ms = journal_clock_ms();
+    if (open_segment(journal) < 0) return -1;
+    journal->wake_fd = eventfd(0, 0);
+    pthread_t tid;
+    pthread_create(&tid, NULL, journal_writer, journal);
+    pthread_detach(tid);
+    return 0;
+}
+
+void journal_submit(Journal *journal, JournalBatch *batch) {
+    JournalBatch *head = atomic_load_explicit(&journal->pending, memory_order_relaxed);
+    do batch->next = head;
+    while (!atomic_compare_exchange_weak_explicit(&journal->pending, &head, batch, memory_order_release,
+                                                  memory_order_relaxed));
+    uint64_t one = 1;
+    write(journal->wake_fd, &one, sizeof(one));
+}
+
+void journal_commit(Journal *journal, JournalBatch *batch, int done_fd) {
+    uint64_t count;
+    batch->done_fd = done_fd;
+    journal_submit(journal, batch);
+    read(done_fd, &count, sizeof(count));
+}
+
+void journal_add(Journal *journal, JournalBatch **batch, int type, unsigned room, unsigned seq, int cell, int colour) {
+    if (*batch && (*batch)->count == JOURNAL_BATCH) {
+        journal_submit(journal, *batch);
+        *batch = NULL;
+    }
+    if (!*batch) {
+        *batch = malloc(sizeof(JournalBatch));
+        (*batch)->count = 0;
+        (*batch)->done_fd = -1;
+    }
+    JournalRecord *r = &(*batch)->records[(*batch)->count++];
+    r->room = room;
+    r->seq = seq;
+    r->time_ms = journal_clock_ms() - journal->epoch_ms;
+    r->type = type;
+    r->cell = cell;
+    r->colour = colour;
+    r->check = record_check(r);
+}
+
+long journal_scan(const char *dir, void (*fn)(const JournalRecord *r, uint64_t epoch_ms, void *arg), void *arg) {
+    int last = last_segment(dir);
+    long total = 0;
+    if (last < 0) return -1;
+    for (int n = 1; n <= last; n++) {
+        char path[300];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%08d.jnl", dir, n);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SegmentHeader)) {
+            close(fd);
+            continue;
+        }
+        const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) continue;
+        madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+        const SegmentHeader *header = (const SegmentHeader *)map;
+        if (header->magic == JOURNAL_MAGIC && header->version == JOURNAL_VERSION) {
+            const JournalRecord *r = (const JournalRecord *)(map + sizeof(SegmentHeader));
+            long count = (st.st_size - sizeof(SegmentHeader)) / sizeof(JournalRecord);
+            for (long i = 0; i < count && record_check(&r[i]) == r[i].check; i++, total++)
+                fn(&r[i], header->epoch_ms, arg);
+        }
+        munmap((void *)map, st.st_size);
+    }
+    return total;
+}
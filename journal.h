@@ -0,0 +1,75 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Append-only game journal: numbered segment files (00000001.jnl, ...) in one directory,
+// each a SegmentHeader followed by fixed-size records in host (little endian) byte order.
+// A new segment is started at every server start and every SEGMENT_SIZE bytes.
+#define JOURNAL_MAGIC 0x4C4E4A47          // "GJNL"
+#define JOURNAL_VERSION 2                 // 2: seeded record check
+#define CHECK_SEED 0xA5                   // Starting value of the record check
+#define SEGMENT_SIZE (64 << 20)
+#define JOURNAL_BATCH 256                 // Records per batch handed to the writer
+
+#define JR_START 1      // Room created, colour is the engine's colour (EMPTY between humans)
+#define JR_MOVE 2       // Stone placed: cell, colour, seq
+#define JR_RESULT 3     // Game over, colour is the winner (EMPTY for a draw)
+#define JR_END 4        // Room closed
+#define JR_SEAT 5       // Human seat of a new room: colour, and its RESUME token as seq
+#define JR_RATING 6     // Rating of the player in seat colour when the room was created, as seq
+
+typedef struct {
+    uint32_t room, seq;
+    uint32_t time_ms;                     // Since the segment's epoch
+    uint8_t type, cell, colour;
+    uint8_t check;                        // CHECK_SEED XOR the 15 other bytes, a torn record fails it
+} JournalRecord;
+
+typedef struct {
+    uint32_t magic, version;
+    uint64_t epoch_ms;                    // Wall-clock time the records' time_ms count from
+} SegmentHeader;
+
+// Records collected by one worker during an event-loop iteration
+typedef struct JournalBatch {
+    struct JournalBatch *next;
+    int count;
+    int done_fd;                          // eventfd posted once the batch is on disk, -1 for none
+    JournalRecord records[JOURNAL_BATCH];
+} JournalBatch;
+
+// Group commit: workers push whole batches with a lock-free push; the writer thread takes every
+// pending batch at once, writes them, syncs the segment once for the whole group, then wakes
+// up the workers waiting for them
+typedef struct {
+    char dir[256];
+    int fd, segment;                      // Current segment file and its number
+    uint64_t size, epoch_ms;
+    _Atomic(JournalBatch *) pending;
+    int wake_fd;                          // eventfd the writer sleeps on
+} Journal;
+
+uint64_t journal_clock_ms(void);
+
+// Create the directory if needed, start a new segment after the existing ones and the writer
+// thread; return -1 on failure
+int journal_open(Journal *journal, const char *dir);
+
+// Append a record to a worker's batch, starting a batch if there is none or it is full
+// (a full batch is submitted first)
+void journal_add(Journal *journal, JournalBatch **batch, int type, unsigned room, unsigned seq, int cell, int colour);
+
+// Hand a batch to the writer thread
+void journal_submit(Journal *journal, JournalBatch *batch);
+
+// Hand a batch to the writer thread and wait on done_fd (a blocking eventfd) until it, and every
+// batch submitted before it, is on disk
+void journal_commit(Journal *journal, JournalBatch *batch, int done_fd);
+
+// mmap every segment in order and call fn for each valid record; a torn tail ends its segment.
+// Return the number of records, -1 if the directory cannot be read.
+long journal_scan(const char *dir, void (*fn)(const JournalRecord *r, uint64_t epoch_ms, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,78 @@
+#include <time.h>
+#include "journal.h"
+#include "commun.h"
+
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define LENGTH_BUCKETS (CELLS + 1)
+
+// Totals gathered over the whole journal
+typedef struct {
+    long rooms, games, moves, wins[3];     // wins[EMPTY] counts the draws
+    long lengths[LENGTH_BUCKETS];          // Games by number of moves
+    long openings[CELLS];                  // First move of each game
+} Stats;
+
+// Moves played so far in the current game of each room, by room id: the records of
+// concurrent rooms interleave
+static unsigned char *game_moves;
+static unsigned game_size;
+
+static void scan_record(const JournalRecord *r, uint64_t epoch_ms, void *arg) {
+    Stats *stats = arg;
+    if (r->room >= game_size) {
+        unsigned size = game_size ? game_size : 1 << 16;
+        while (size <= r->room) size *= 2;
+        game_moves = realloc(game_moves, size);
+        memset(game_moves + game_size, 0, size - game_size);
+        game_size = size;
+    }
+    switch (r->type) {
+    case JR_START:
+        stats->rooms++;
+        game_moves[r->room] = 0;
+        break;
+    case JR_MOVE:
+        if (game_moves[r->room] == 0 && r->cell < CELLS) stats->openings[r->cell]++;
+        if (game_moves[r->room] < CELLS) game_moves[r->room]++;
+        stats->moves++;
+        break;
+    case JR_RESULT:
+        stats->games++;
+        if (r->colour <= WHITE) stats->wins[r->colour]++;
+        stats->lengths[game_moves[r->room]]++;
+        game_moves[r->room] = 0;
+        break;
+    }
+}
+
+// Scan every segment of a journal directory and print what was played
+int main(int argc, char *argv[]) {
+    static Stats stats;
+    struct timespec start, end;
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s journal_directory\n", argv[0]);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long records = journal_scan(argv[1], scan_record, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (records < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long length_sum = 0, best = 0;
+    for (int i = 0; i < LENGTH_BUCKETS; i++) length_sum += (long)i * stats.lengths[i];
+    for (int i = 1; i < CELLS; i++)
+        if (stats.openings[i] > stats.openings[best]) best = i;
+
+    printf("%ld records, %ld rooms, %ld games, %ld moves\n", records, stats.rooms, stats.games, stats.moves);
+    if (stats.games) {
+        printf("Black won %.1f%%, white %.1f%%, draws %.1f%%\n", 100.0 * stats.wins[BLACK] / stats.games,
+               100.0 * stats.wins[WHITE] / stats.games, 100.0 * stats.wins[EMPTY] / stats.games);
+        printf("Average game: %.1f moves\n", (double)length_sum / stats.games);
+        printf("Most played opening: %ld %ld (%ld games)\n", best / BOARD_SIZE, best % BOARD_SIZE, stats.openings[best]);
+    }
+    printf("Scanned in %.3f s: %.0f records/s, %.0f games/s\n", seconds, records / seconds, stats.games / seconds);
+    return 0;
+}
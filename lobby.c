@@ -0,0 +1,152 @@
+#include <math.h>
+#include "commun.h"
+#include "lobby.h"
+
+#define ELO_K 32
+
+int lobby_window(const LobbyEntry *e, uint64_t now) {
+    uint64_t steps = (now - e->joined_ms) / WIDEN_MS;
+    if (steps > RATING_BUCKETS / WINDOW_STEP) return RATING_BUCKETS;
+    return WINDOW_BASE + WINDOW_STEP * (int)steps;
+}
+
+static void tree_add(Lobby *lobby, int bucket, int delta) {
+    for (int i = bucket + 1; i <= RATING_BUCKETS; i += i & -i) lobby->tree[i] += delta;
+}
+
+// Number of waiting players rated below `bucket`
+static int tree_prefix(const Lobby *lobby, int bucket) {
+    int sum = 0;
+    for (int i = bucket; i > 0; i -= i & -i) sum += lobby->tree[i];
+    return sum;
+}
+
+// Bucket of the k-th waiting player (from 1) in rating order
+static int tree_find(const Lobby *lobby, int k) {
+    int pos = 0;
+    for (int step = RATING_BUCKETS; step; step >>= 1)
+        if (pos + step <= RATING_BUCKETS && lobby->tree[pos + step] < k) {
+            pos += step;
+            k -= lobby->tree[pos];
+        }
+    return pos;
+}
+
+static void check_remove(Lobby *lobby, LobbyEntry *e) {
+    if (!e->checked) return;
+    if (e->check_prev) e->check_prev->check_next = e->check_next;
+    else lobby->check_head = e->check_next;
+    if (e->check_next) e->check_next->check_prev = e->check_prev;
+    else lobby->check_tail = e->check_prev;
+    e->checked = 0;
+}
+
+void lobby_add(Lobby *lobby, LobbyEntry *e, uint64_t now) {
+    int b = e->rating;
+    // A player already waiting keeps its place in its bucket, only its recheck is queued again
+    if (!e->queued) {
+        e->queued = 1;
+        e->next = NULL;
+        e->prev = lobby->tail[b];
+        if (lobby->tail[b]) lobby->tail[b]->next = e;
+        else lobby->head[b] = e;
+        lobby->tail[b] = e;
+        tree_add(lobby, b, 1);
+        lobby->count++;
+    }
+    // Once the window covers every rating, a new arrival is the only possible match
+    if (lobby_window(e, now) >= RATING_BUCKETS) return;
+    e->check_ms = now + WIDEN_MS;
+    e->checked = 1;
+    e->check_next = NULL;
+    e->check_prev = lobby->check_tail;
+    if (lobby->check_tail) lobby->check_tail->check_next = e;
+    else lobby->check_head = e;
+    lobby->check_tail = e;
+}
+
+void lobby_remove(Lobby *lobby, LobbyEntry *e) {
+    int b = e->rating;
+    if (e->prev) e->prev->next = e->next;
+    else lobby->head[b] = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lobby->tail[b] = e->prev;
+    tree_add(lobby, b, -1);
+    lobby->count--;
+    e->queued = 0;
+    check_remove(lobby, e);
+}
+
+LobbyEntry *lobby_match(Lobby *lobby, const LobbyEntry *e, uint64_t now) {
+    int below = tree_prefix(lobby, e->rating + 1);   // Players rated <= e->rating, e too if it waits
+    LobbyEntry *best = NULL;
+    int best_diff = 0;
+    // The nearest rating on each side; within a rating, the one waiting longest
+    for (int side = 0; side < 2; side++) {
+        int k = side ? below + 1 : below - e->queued;
+        if (k < 1 || k > lobby->count) continue;
+        LobbyEntry *c = lobby->head[tree_find(lobby, k)];
+        if (c == e) c = c->next;
+        if (!c) continue;
+        int diff = abs(c->rating - e->rating);
+        if (!best || diff < best_diff || (diff == best_diff && c->joined_ms < best->joined_ms)) {
+            best = c;
+            best_diff = diff;
+        }
+    }
+    if (!best) return NULL;
+    int window = lobby_window(e, now), other = lobby_window(best, now);
+    return best_diff <= (window > other ? window : other) ? best : NULL;
+}
+
+LobbyEntry *lobby_due(Lobby *lobby, uint64_t now) {
+    LobbyEntry *e = lobby->check_head;
+    if (!e || e->check_ms > now) return NULL;
+    check_remove(lobby, e);
+    return e;
+}
+
+int lobby_next_check(const Lobby *lobby, uint64_t now) {
+    if (!lobby->check_head) return -1;
+    return lobby->check_head->check_ms > now ? (int)(lobby->check_head->check_ms - now) : 0;
+}
+
+static unsigned name_hash(const char *name) {
+    unsigned h = 2166136261u;                        // FNV-1a
+    while (*name) h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h % RATING_HASH;
+}
+
+int rating_get(const RatingTable *table, const char *name) {
+    for (RatingEntry *e = table->buckets[name_hash(name)]; e; e = e->next)
+        if (strcmp(e->name, name) == 0) return e->rating;
+    return RATING_START;
+}
+
+void rating_set(RatingTable *table, const char *name, int rating) {
+    unsigned h = name_hash(name);
+    RatingEntry *e;
+    for (e = table->buckets[h]; e; e = e->next)
+        if (strcmp(e->name, name) == 0) break;
+    if (!e) {
+        e = calloc(1, sizeof(RatingEntry));
+        snprintf(e->name, NAME_SIZE, "%s", name);
+        e->next = table->buckets[h];
+        table->buckets[h] = e;
+    }
+    e->rating = rating;
+}
+
+static int clamp_rating(double r) {
+    return r < 0 ? 0 : r > RATING_BUCKETS - 1 ? RATING_BUCKETS - 1 : (int)lround(r);
+}
+
+void elo_update(int *black, int *white, int black_wins, int white_wins, int draws) {
+    int games = black_wins + white_wins + draws;
+    if (games == 0) return;
+    double expected = 1 / (1 + pow(10, (*white - *black) / 400.0));   // Black's expected score per game
+    double delta = ELO_K * (black_wins + draws / 2.0 - games * expected);
+    int b = *black, w = *white;
+    *black = clamp_rating(b + delta);
+    *white = clamp_rating(w - delta);
+}
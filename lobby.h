@@ -0,0 +1,69 @@
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include <stdint.h>
+
+#define RATING_BUCKETS 4096  // Ratings are clamped to [0, RATING_BUCKETS), one bucket per point
+#define RATING_START 1500    // Rating of a new or anonymous player
+#define WINDOW_BASE 50       // Rating difference accepted right away
+#define WINDOW_STEP 50       // ... widened by this much every WIDEN_MS of waiting
+#define WIDEN_MS 1000
+#define NAME_SIZE 16
+
+// A waiting player, embedded in the server's connection
+typedef struct LobbyEntry {
+    int rating, queued, checked;           // In the lobby / in the recheck queue
+    uint64_t joined_ms, check_ms;          // When the player started waiting / is rechecked next
+    struct LobbyEntry *prev, *next;        // Bucket list, longest waiting first
+    struct LobbyEntry *check_prev, *check_next;
+} LobbyEntry;
+
+// Waiting players indexed by rating: a list per rating point and a Fenwick tree over the
+// list sizes, so adding, removing and finding the nearest rating are O(log RATING_BUCKETS)
+// however many players wait. Windows widen with the wait, so every player is also in a
+// recheck queue; all rechecks are WIDEN_MS apart, which keeps that queue in time order.
+typedef struct {
+    int tree[RATING_BUCKETS + 1];
+    LobbyEntry *head[RATING_BUCKETS], *tail[RATING_BUCKETS];
+    LobbyEntry *check_head, *check_tail;
+    int count;
+} Lobby;
+
+// Rating window of a player who has been waiting since joined_ms
+int lobby_window(const LobbyEntry *e, uint64_t now);
+
+// Start (or keep) waiting; e->rating and e->joined_ms are set by the caller
+void lobby_add(Lobby *lobby, LobbyEntry *e, uint64_t now);
+void lobby_remove(Lobby *lobby, LobbyEntry *e);
+
+// Closest-rated waiting player within the window of either side, NULL if there is none;
+// e may be waiting itself
+LobbyEntry *lobby_match(Lobby *lobby, const LobbyEntry *e, uint64_t now);
+
+// Take the next player whose window has widened since it was last checked out of the recheck
+// queue, NULL if there is none. It keeps its place in its bucket: the caller matches it (and
+// removes it) or adds it again, which only queues its next recheck.
+LobbyEntry *lobby_due(Lobby *lobby, uint64_t now);
+
+// ms until the next recheck, -1 if there is none
+int lobby_next_check(const Lobby *lobby, uint64_t now);
+
+// Ratings of the named players, kept in memory for the server's lifetime
+typedef struct RatingEntry {
+    char name[NAME_SIZE];
+    int rating;
+    struct RatingEntry *next;
+} RatingEntry;
+
+#define RATING_HASH 65536
+typedef struct {
+    RatingEntry *buckets[RATING_HASH];
+} RatingTable;
+
+int rating_get(const RatingTable *table, const char *name);
+void rating_set(RatingTable *table, const char *name, int rating);
+
+// Elo update over a match: each game won counts 1, each draw 1/2
+void elo_update(int *black, int *white, int black_wins, int white_wins, int draws);
+
+#endif
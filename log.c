@@ -0,0 +1,151 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+
+#define LOG_BATCH 4096      // Records formatted per write
+
+// Single-producer single-consumer ring of one thread's records
+typedef struct LogRing {
+    LogRecord records[LOG_RING];
+    _Atomic unsigned head, tail;           // The writer advances head, the owning thread tail
+    _Atomic unsigned long dropped;
+    unsigned taken;                        // Records in the batch being written
+    struct LogRing *next;
+} LogRing;
+
+static _Atomic(LogRing *) rings;           // Every thread that logged, pushed lock-free on first use
+static _Thread_local LogRing *own_ring;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *level_names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+static uint64_t log_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void log_write(int level, const char *text, const char *fmt, const int64_t *args, int nargs) {
+    LogRing *ring = own_ring;
+    if (!ring) {
+        ring = own_ring = calloc(1, sizeof(LogRing));
+        LogRing *head = atomic_load_explicit(&rings, memory_order_relaxed);
+        do ring->next = head;
+        while (!atomic_compare_exchange_weak_explicit(&rings, &head, ring, memory_order_release, memory_order_relaxed));
+    }
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    LogRecord *r = &ring->records[tail % LOG_RING];
+    r->time_ns = log_clock_ns();
+    r->fmt = fmt;
+    r->level = level;
+    r->nargs = nargs < LOG_ARGS ? nargs : LOG_ARGS;
+    memcpy(r->args, args, r->nargs * sizeof(int64_t));
+    if (text) {
+        strncpy(r->text, text, LOG_TEXT - 1);
+        r->text[LOG_TEXT - 1] = '\0';
+    } else r->text[0] = '\0';
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Expand a record's format: each conversion takes the next integer argument, %s the text
+static int format_record(const LogRecord *r, char *out, int size) {
+    time_t seconds = r->time_ns / 1000000000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    int len = snprintf(out, size, "%02d:%02d:%02d.%03d %s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                       (int)(r->time_ns / 1000000 % 1000), level_names[r->level]);
+    int arg = 0;
+    for (const char *p = r->fmt; *p && len < size - 1; p++) {
+        if (*p != '%') {
+            out[len++] = *p;
+            continue;
+        }
+        // Copy the flags and width, drop the length modifiers: every integer is printed as 64 bits
+        char spec[16] = "%";
+        int n = 1;
+        while (*++p && strchr("-+ #0123456789.", *p) && n < 12) spec[n++] = *p;
+        while (*p == 'l' || *p == 'h' || *p == 'z') p++;
+        if (!*p) break;
+        int64_t value = arg < r->nargs ? r->args[arg] : 0;
+        if (*p == '%') len += snprintf(out + len, size - len, "%%");
+        else if (*p == 's') {
+            spec[n++] = 's';
+            len += snprintf(out + len, size - len, spec, r->text);
+        } else if (*p == 'c') {
+            spec[n++] = 'c';
+            len += snprintf(out + len, size - len, spec, (int)value);
+            arg++;
+        } else {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = strchr("uxXo", *p) ? *p : 'd';
+            len += snprintf(out + len, size - len, spec, (long long)value);
+            arg++;
+        }
+    }
+    if (len > size - 1) len = size - 1;
+    out[len++] = '\n';
+    return len;
+}
+
+static int by_time(const void *a, const void *b) {
+    uint64_t x = (*(LogRecord *const *)a)->time_ns, y = (*(LogRecord *const *)b)->time_ns;
+    return x < y ? -1 : x > y;
+}
+
+void log_drain(void) {
+    static LogRecord *batch[LOG_BATCH];
+    static char text[LOG_BATCH * 128];
+    pthread_mutex_lock(&drain_lock);
+    int more = 1;
+    while (more) {
+        // Take what every thread logged, in time order, then let the threads reuse the slots
+        int count = 0;
+        more = 0;
+        for (LogRing *ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next) {
+            unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            for (ring->taken = 0; head != tail && count < LOG_BATCH; head++, ring->taken++)
+                batch[count++] = &ring->records[head % LOG_RING];
+            more |= head != tail;
+        }
+        if (!count) break;
+        qsort(batch, count, sizeof(batch[0]), by_time);
+        int len = 0;
+        for (int i = 0; i < count; i++) len += format_record(batch[i], text + len, 128);
+        for (int off = 0, n; off < len; off += n)
+            if ((n = write(STDOUT_FILENO, text + off, len - off)) <= 0) break;
+        for (LogRing *ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next) {
+            unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            atomic_store_explicit(&ring->head, head + ring->taken, memory_order_release);
+            ring->taken = 0;
+            unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+            if (dropped) dprintf(STDOUT_FILENO, "(%lu log records dropped)\n", dropped);
+        }
+    }
+    pthread_mutex_unlock(&drain_lock);
+}
+
+static void *log_thread(void *arg) {
+    struct timespec period = {0, LOG_FLUSH_MS * 1000000};
+    while (1) {
+        nanosleep(&period, NULL);
+        log_drain();
+    }
+    return NULL;
+}
+
+void log_init(void) {
+    pthread_t tid;
+    pthread_create(&tid, NULL, log_thread, NULL);
+    pthread_detach(tid);
+    atexit(log_drain);
+}
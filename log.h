@@ -0,0 +1,53 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+// Calls below LOG_LEVEL compile to nothing, arguments included
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_RING 1024       // Records a thread may log before the writer catches up; more are dropped
+#define LOG_ARGS 4
+#define LOG_TEXT 78
+#define LOG_FLUSH_MS 10     // How often the writer thread formats and writes what was logged
+
+// One log call, stored as is: formatting waits for the writer thread.
+// fmt must be a string literal; its %s, if any, is `text`, every other conversion an integer.
+typedef struct {
+    uint64_t time_ns;
+    const char *fmt;
+    int64_t args[LOG_ARGS];
+    uint8_t level, nargs;
+    char text[LOG_TEXT];
+} LogRecord;
+
+// Start the writer thread; records are written to stdout and the rest is written at exit
+void log_init(void);
+
+void log_write(int level, const char *text, const char *fmt, const int64_t *args, int nargs);
+
+// Write everything logged so far, from any thread
+void log_drain(void);
+
+#define LOG_ARGV(...) ((const int64_t[]){0, ##__VA_ARGS__} + 1)
+#define LOG_ARGC(...) (int)(sizeof((int64_t[]){0, ##__VA_ARGS__}) / sizeof(int64_t) - 1)
+
+// Log with one string argument, copied for the %s of fmt
+#define log_text(level, text, fmt, ...)                                                            \
+    do {                                                                                           \
+        if ((level) >= LOG_LEVEL) log_write(level, text, fmt, LOG_ARGV(__VA_ARGS__), LOG_ARGC(__VA_ARGS__)); \
+    } while (0)
+
+#define log_debug(fmt, ...) log_text(LOG_DEBUG, NULL, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...) log_text(LOG_INFO, NULL, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...) log_text(LOG_WARN, NULL, fmt, ##__VA_ARGS__)
+#define log_error(fmt, ...) log_text(LOG_ERROR, NULL, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+static const char *counter_names[METRIC_COUNT] = {"accepts", "moves", "invalid", "bytes_in", "bytes_out"};
+// Histograms are reported in the unit that suits them
+static const char *hist_names[HIST_COUNT] = {"check_win_ns", "move_us", "vote_ms"};
+static const uint64_t hist_units[HIST_COUNT] = {1, 1000, 1000000};
+
+uint64_t metrics_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void metrics_merge(MetricsSnapshot *snap, Metrics *m) {
+    for (int i = 0; i < METRIC_COUNT; i++) snap->counters[i] += atomic_load_explicit(&m->counters[i], memory_order_relaxed);
+    for (int h = 0; h < HIST_COUNT; h++) {
+        Histogram *hist = &m->hist[h];
+        for (int i = 0; i < HIST_BUCKETS; i++)
+            snap->counts[h][i] += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        snap->total[h] += atomic_load_explicit(&hist->total, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+        if (max > snap->max[h]) snap->max[h] = max;
+    }
+}
+
+uint64_t hist_quantile(const MetricsSnapshot *snap, int id, double q) {
+    uint64_t rank = q * snap->total[id], seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += snap->counts[id][i];
+        if (seen > rank) {
+            if (i < (1 << HIST_SUB_BITS)) return i;
+            int shift = (i >> HIST_SUB_BITS) - 1;
+            return (uint64_t)((1 << HIST_SUB_BITS) + (i & ((1 << HIST_SUB_BITS) - 1))) << shift;
+        }
+    }
+    return snap->max[id];
+}
+
+int metrics_format(const MetricsSnapshot *snap, const MetricsSnapshot *prev, double seconds, char *out, int size) {
+    int len = 0;
+    for (int i = 0; i < METRIC_COUNT && len < size; i++) {
+        len += snprintf(out + len, size - len, "%s %llu", counter_names[i], (unsigned long long)snap->counters[i]);
+        if (prev && seconds > 0 && len < size)
+            len += snprintf(out + len, size - len, " (%.0f/s)", (snap->counters[i] - prev->counters[i]) / seconds);
+        if (len < size) len += snprintf(out + len, size - len, "\n");
+    }
+    for (int h = 0; h < HIST_COUNT && len < size; h++) {
+        uint64_t unit = hist_units[h];
+        len += snprintf(out + len, size - len, "%s n %llu p50 %llu p99 %llu p999 %llu max %llu\n", hist_names[h],
+                        (unsigned long long)snap->total[h], (unsigned long long)(hist_quantile(snap, h, 0.5) / unit),
+                        (unsigned long long)(hist_quantile(snap, h, 0.99) / unit),
+                        (unsigned long long)(hist_quantile(snap, h, 0.999) / unit),
+                        (unsigned long long)(snap->max[h] / unit));
+    }
+    if (len >= size) len = size - 1;
+    // No trailing newline: the report travels as one text message
+    if (len > 0 && out[len - 1] == '\n') out[--len] = '\0';
+    return len;
+}
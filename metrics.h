@@ -0,0 +1,80 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Counters
+#define M_ACCEPTS 0
+#define M_MOVES 1
+#define M_INVALID 2         // Illegal or out-of-turn MOVE commands
+#define M_BYTES_IN 3
+#define M_BYTES_OUT 4
+#define METRIC_COUNT 5
+
+// Histograms, all recorded in ns
+#define H_CHECK_WIN 0
+#define H_MOVE 1            // From the wakeup that brought the move to the flush of its broadcast
+#define H_VOTE 2            // From the end of a game to the votes being settled
+#define HIST_COUNT 3
+
+// HDR-style log-linear buckets: values below 2^HIST_SUB_BITS are exact, each power of two above
+// is split in 2^HIST_SUB_BITS buckets, so a bucket is never off by more than 1/32 of its value
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+#define STATS_MAX 1024      // Longest STATS report
+
+typedef struct {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t total, max;
+} Histogram;
+
+// Metrics of one thread. Only that thread writes them, so an update is a plain load and store;
+// readers on other threads merge them with relaxed loads and never stop the writer.
+typedef struct {
+    _Atomic uint64_t counters[METRIC_COUNT];
+    Histogram hist[HIST_COUNT];
+} Metrics;
+
+// Sum of every thread's metrics at one point in time
+typedef struct {
+    uint64_t counters[METRIC_COUNT];
+    uint64_t counts[HIST_COUNT][HIST_BUCKETS];
+    uint64_t total[HIST_COUNT], max[HIST_COUNT];
+} MetricsSnapshot;
+
+static inline void single_add(_Atomic uint64_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metric_add(Metrics *m, int id, uint64_t n) { single_add(&m->counters[id], n); }
+
+static inline int hist_index(uint64_t value) {
+    if (value < (1 << HIST_SUB_BITS)) return value;
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + ((value >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// Record `count` samples of the same value
+static inline void hist_record(Metrics *m, int id, uint64_t value, uint64_t count) {
+    Histogram *h = &m->hist[id];
+    single_add(&h->counts[hist_index(value)], count);
+    single_add(&h->total, count);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+uint64_t metrics_clock_ns(void);
+
+// Add one thread's metrics to a snapshot
+void metrics_merge(MetricsSnapshot *snap, Metrics *m);
+
+// Smallest value of the bucket holding the q-quantile (0 to 1) of a histogram
+uint64_t hist_quantile(const MetricsSnapshot *snap, int id, double q);
+
+// Write a report of the counters and histograms, one line each; with a previous snapshot taken
+// `seconds` earlier, the counters come with their rates. Return its length.
+int metrics_format(const MetricsSnapshot *snap, const MetricsSnapshot *prev, double seconds, char *out, int size);
+
+#endif
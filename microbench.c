@@ -0,0 +1,244 @@
+#include <time.h>
+#include "gomoku.h"
+#include "protocol.h"
+
+#define POSITIONS 4096      // Prepared inputs, cycled through by every benchmark
+#define BATCH 64            // Operations per timed sample: one clock read costs more than most of them
+#define MAX_SAMPLES (1 << 20)
+
+// Inputs: random midgame positions and dense adversarial ones, each with the move to judge
+typedef struct {
+    Game game;                             // Before the move
+    Bitboard after;                        // With the move placed, for the whole-board test
+    int row, col, colour;
+} Position;
+
+static const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+
+static Position random_pos[POSITIONS], dense_pos[POSITIONS], renju_pos[POSITIONS];
+static unsigned char binary_frames[POSITIONS][BOARD_FRAME_SIZE];
+static char text_boards[POSITIONS][TEXT_BOARD_MAX];
+static int text_lengths[POSITIONS];
+static unsigned char delta_frames[POSITIONS][DELTA_FRAME_SIZE];
+static uint64_t samples[MAX_SAMPLES];
+static uint64_t rng = 42;
+static volatile int sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t next_random(void) {
+    uint64_t z = (rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Random empty cell where the player to move may play without ending the game; -1 if none
+static int quiet_cell(const Game *game) {
+    int start = next_random() % (BOARD_SIZE * BOARD_SIZE);
+    for (int k = 0; k < BOARD_SIZE * BOARD_SIZE; k++) {
+        int i = (start + k) % (BOARD_SIZE * BOARD_SIZE);
+        if (game_check(game, i / BOARD_SIZE, i % BOARD_SIZE, game->current_player) == GAME_ONGOING) return i;
+    }
+    return -1;
+}
+
+// Empty cell joining the longest runs of `colour` over the four directions: the most steps
+// for a line scan, and the cell most likely to complete five
+static int crowded_cell(const Game *game, int colour) {
+    int best = -1, best_len = -1;
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; i++) {
+        int row = i / BOARD_SIZE, col = i % BOARD_SIZE, len = 0;
+        if (!bb_is_empty(&game->board, row, col)) continue;
+        for (int d = 0; d < 4; d++)
+            for (int s = -1; s <= 1; s += 2)
+                for (int r = row + s * directions[d][0], c = col + s * directions[d][1];
+                     r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE && bb_get(&game->board, r, c) == colour;
+                     r += s * directions[d][0], c += s * directions[d][1])
+                    len++;
+        if (len > best_len) best_len = len, best = i;
+    }
+    return best;
+}
+
+// Play up to `moves` quiet moves from the empty board, then pick the move to judge
+static void make_position(Position *pos, int moves, int dense) {
+    int cell = -1;
+    while (cell < 0) {
+        game_reset(&pos->game);
+        for (int m = 0; m < moves && (cell = quiet_cell(&pos->game)) >= 0; m++)
+            game_play(&pos->game, cell / BOARD_SIZE, cell % BOARD_SIZE);
+        pos->colour = pos->game.current_player;
+        cell = dense ? crowded_cell(&pos->game, pos->colour) : quiet_cell(&pos->game);
+    }
+    pos->row = cell / BOARD_SIZE;
+    pos->col = cell % BOARD_SIZE;
+    pos->after = pos->game.board;
+    bb_place(&pos->after, pos->row, pos->col, pos->colour);
+}
+
+static void prepare(void) {
+    for (int i = 0; i < POSITIONS; i++) {
+        game_init(&random_pos[i].game, RULES_FREESTYLE);
+        make_position(&random_pos[i], 10 + next_random() % 80, 0);
+        game_init(&dense_pos[i].game, RULES_FREESTYLE);
+        make_position(&dense_pos[i], 150 + next_random() % 60, 1);
+        // Black to move under Renju, where every move goes through the pattern tables
+        game_init(&renju_pos[i].game, RULES_RENJU);
+        make_position(&renju_pos[i], 2 * (10 + next_random() % 40), 0);
+
+        BoardMsg msg = {.current_player = BLACK, .black_score = 3, .white_score = 2, .seq = i};
+        bb_to_cells(&random_pos[i].game.board, msg.board);
+        msg.clocks = (Clocks){{300000, 250000}, {0, 0}};
+        encode_board_binary(binary_frames[i], &msg);
+        text_lengths[i] = encode_board_text(text_boards[i], &msg);
+        DeltaMsg delta = {i, random_pos[i].row, random_pos[i].col, BLACK, WHITE, msg.clocks};
+        encode_delta(delta_frames[i], &delta);
+    }
+}
+
+// The scalar check the rules used before: walk each direction from the move, one bounds-checked
+// cell at a time. Kept as the baseline the bit-parallel checks must beat.
+static int scan_win(const Bitboard *bb, int row, int col, int colour) {
+    const Bitset *stones = &bb->stones[colour - 1];
+    for (int d = 0; d < 4; d++) {
+        int dr = directions[d][0], dc = directions[d][1], n = 1;
+        for (int s = -1; s <= 1; s += 2)
+            for (int r = row + s * dr, c = col + s * dc;
+                 r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE && bs_test(stones, bb_index(r, c));
+                 r += s * dr, c += s * dc)
+                n++;
+        if (n >= 5) return 1;
+    }
+    return 0;
+}
+
+// The operations, each on input i
+static void board_random(int i) { sink += bb_check_win(&random_pos[i].after, random_pos[i].colour); }
+static void board_dense(int i) { sink += bb_check_win(&dense_pos[i].after, dense_pos[i].colour); }
+static void move_random(int i) {
+    Position *p = &random_pos[i];
+    sink += game_check(&p->game, p->row, p->col, p->colour);
+}
+static void move_dense(int i) {
+    Position *p = &dense_pos[i];
+    sink += game_check(&p->game, p->row, p->col, p->colour);
+}
+static void scan_random(int i) {
+    Position *p = &random_pos[i];
+    sink += scan_win(&p->game.board, p->row, p->col, p->colour);
+}
+static void scan_dense(int i) {
+    Position *p = &dense_pos[i];
+    sink += scan_win(&p->game.board, p->row, p->col, p->colour);
+}
+static void renju_random(int i) {
+    Position *p = &renju_pos[i];
+    sink += game_check(&p->game, p->row, p->col, p->colour);
+}
+
+// What the server does per snapshot: expand the bitboard, then encode
+static void send_board_binary(int i) {
+    unsigned char out[BOARD_FRAME_SIZE];
+    BoardMsg msg = {.current_player = BLACK, .seq = i};
+    bb_to_cells(&random_pos[i].game.board, msg.board);
+    sink += encode_board_binary(out, &msg) + out[FRAME_HEADER_SIZE + 20];
+}
+static void send_board_text(int i) {
+    char out[TEXT_BOARD_MAX];
+    BoardMsg msg = {.current_player = BLACK, .seq = i};
+    bb_to_cells(&random_pos[i].game.board, msg.board);
+    sink += encode_board_text(out, &msg) + out[40];
+}
+static void send_delta(int i) {
+    unsigned char out[DELTA_FRAME_SIZE];
+    DeltaMsg delta = {i, random_pos[i].row, random_pos[i].col, BLACK, WHITE};
+    sink += encode_delta(out, &delta) + out[FRAME_HEADER_SIZE + 4];
+}
+
+// What the client does per update
+static void parse_board_binary(int i) {
+    BoardMsg msg;
+    sink += decode_board_binary(binary_frames[i], BOARD_FRAME_SIZE, &msg) + msg.board[7][7];
+}
+static void parse_board_text(int i) {
+    BoardMsg msg;
+    sink += decode_board_text(text_boards[i], text_lengths[i], &msg) + msg.board[7][7];
+}
+static void parse_delta(int i) {
+    DeltaMsg delta;
+    sink += decode_delta(delta_frames[i], DELTA_FRAME_SIZE, &delta) + delta.row;
+}
+
+static const struct {
+    const char *name;
+    void (*op)(int i);
+} benchmarks[] = {
+    {"check_win_board_random", board_random},
+    {"check_win_board_adversarial", board_dense},
+    {"check_win_move_random", move_random},
+    {"check_win_move_adversarial", move_dense},
+    {"check_win_scan_random", scan_random},
+    {"check_win_scan_adversarial", scan_dense},
+    {"check_renju_random", renju_random},
+    {"send_board_binary", send_board_binary},
+    {"send_board_text", send_board_text},
+    {"send_delta", send_delta},
+    {"parse_board_binary", parse_board_binary},
+    {"parse_board_text", parse_board_text},
+    {"parse_delta", parse_delta},
+};
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run every benchmark for about `ms` and print the results as JSON: mean ns/op over the run,
+// and the p50 and p99 of the per-batch means
+int main(int argc, char *argv[]) {
+    int ms = 300, opt, count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    const char *only = NULL;
+    while ((opt = getopt(argc, argv, "t:b:")) != -1) {
+        if (opt == 't' && atoi(optarg) > 0) ms = atoi(optarg);
+        else if (opt == 'b') only = optarg;
+        else {
+            fprintf(stderr, "Usage: %s [-t ms per benchmark] [-b benchmark name]\n", argv[0]);
+            return 1;
+        }
+    }
+    prepare();
+    printf("[");
+    const char *separator = "\n";
+    for (int b = 0; b < count; b++) {
+        if (only && strcmp(only, benchmarks[b].name) != 0) continue;
+        void (*op)(int) = benchmarks[b].op;
+        // Warm the caches and the branch predictors first
+        for (int i = 0; i < POSITIONS; i++) op(i);
+        long n = 0, input = 0;
+        uint64_t start = now_ns(), end = start + (uint64_t)ms * 1000000, total = 0;
+        while (n < MAX_SAMPLES) {
+            uint64_t t0 = now_ns();
+            for (int k = 0; k < BATCH; k++) {
+                op(input);
+                input = (input + 1) % POSITIONS;
+            }
+            uint64_t t1 = now_ns();
+            samples[n++] = t1 - t0;
+            total += t1 - t0;
+            if (t1 >= end) break;
+        }
+        qsort(samples, n, sizeof(uint64_t), cmp_u64);
+        printf("%s  {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.2f, \"p50_ns\": %.2f, \"p99_ns\": %.2f}", separator,
+               benchmarks[b].name, n * BATCH, (double)total / (n * BATCH), (double)samples[n / 2] / BATCH,
+               (double)samples[(long)(0.99 * (n - 1))] / BATCH);
+        separator = ",\n";
+        fflush(stdout);
+    }
+    printf("\n]\n");
+    return 0;
+}
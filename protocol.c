@@ -0,0 +1,163 @@
+#include "protocol.h"
+
+// Write a binary frame header in front of a payload of the given length
+static void put_header(unsigned char *out, int type, int len) {
+    out[0] = PROTO_MAGIC;
+    out[1] = PROTO_BINARY;
+    out[2] = type;
+    out[3] = len & 0xff;
+    out[4] = len >> 8;
+}
+
+static void put_u32(unsigned char *p, unsigned v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static unsigned get_u32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static void put_clocks(unsigned char *p, const Clocks *clocks) {
+    put_u32(p, clocks->ms[0]);
+    put_u32(p + 4, clocks->ms[1]);
+    p[8] = clocks->periods[0];
+    p[9] = clocks->periods[1];
+}
+
+// Messages from before the clocks were added end where the clocks start
+static void get_clocks(const unsigned char *frame, int offset, Clocks *clocks) {
+    int payload = frame[3] | frame[4] << 8;
+    if (payload < offset - FRAME_HEADER_SIZE + CLOCKS_SIZE) {
+        clocks->ms[0] = clocks->ms[1] = NO_CLOCK;
+        clocks->periods[0] = clocks->periods[1] = 0;
+        return;
+    }
+    const unsigned char *p = frame + offset;
+    clocks->ms[0] = get_u32(p);
+    clocks->ms[1] = get_u32(p + 4);
+    clocks->periods[0] = p[8];
+    clocks->periods[1] = p[9];
+}
+
+// Pack the board at 2 bits per cell, followed by turn, state, scores, sequence number and clocks
+int encode_board_binary(unsigned char *out, const BoardMsg *msg) {
+    unsigned char *p = out + FRAME_HEADER_SIZE;
+    const int *cells = &msg->board[0][0];
+    put_header(out, MSG_BOARD, BOARD_PAYLOAD_SIZE);
+    memset(p, 0, PACKED_BOARD_SIZE);
+    for (int i = 0; i < CELL_COUNT; i++)
+        p[i >> 2] |= (cells[i] & 3) << ((i & 3) * 2);
+    p += PACKED_BOARD_SIZE;
+    *p++ = msg->current_player;
+    *p++ = msg->move_state;
+    *p++ = msg->black_score & 0xff; *p++ = msg->black_score >> 8;
+    *p++ = msg->white_score & 0xff; *p++ = msg->white_score >> 8;
+    put_u32(p, msg->seq);
+    put_clocks(p + 4, &msg->clocks);
+    return BOARD_FRAME_SIZE;
+}
+
+// Text fallback, same layout as the original protocol
+int encode_board_text(char *out, const BoardMsg *msg) {
+    int len = sprintf(out, "BOARD %d %d \n", msg->current_player, msg->move_state);
+    for (int i = 0; i < BOARD_SIZE; i++)
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            out[len++] = '0' + msg->board[i][j];
+            out[len++] = ' ';
+        }
+    len += sprintf(out + len, "%d %d %u %u %d %d\n", msg->black_score, msg->white_score, msg->clocks.ms[0],
+                   msg->clocks.ms[1], msg->clocks.periods[0], msg->clocks.periods[1]);
+    return len;
+}
+
+int decode_board_binary(const unsigned char *frame, int len, BoardMsg *msg) {
+    if (len < BOARD_FRAME_SIZE - CLOCKS_SIZE || frame[1] != PROTO_BINARY || frame[2] != MSG_BOARD) return -1;
+    const unsigned char *p = frame + FRAME_HEADER_SIZE;
+    int *cells = &msg->board[0][0];
+    for (int i = 0; i < CELL_COUNT; i++)
+        cells[i] = (p[i >> 2] >> ((i & 3) * 2)) & 3;
+    p += PACKED_BOARD_SIZE;
+    msg->current_player = p[0];
+    msg->move_state = p[1];
+    msg->black_score = p[2] | p[3] << 8;
+    msg->white_score = p[4] | p[5] << 8;
+    msg->seq = get_u32(p + 6);
+    get_clocks(frame, BOARD_FRAME_SIZE - CLOCKS_SIZE, &msg->clocks);
+    return 0;
+}
+
+int encode_delta(unsigned char *out, const DeltaMsg *msg) {
+    unsigned char *p = out + FRAME_HEADER_SIZE;
+    put_header(out, MSG_DELTA, DELTA_PAYLOAD_SIZE);
+    put_u32(p, msg->seq);
+    p[4] = msg->row * BOARD_SIZE + msg->col;
+    p[5] = msg->colour;
+    p[6] = msg->next_player;
+    put_clocks(p + 7, &msg->clocks);
+    return DELTA_FRAME_SIZE;
+}
+
+int decode_delta(const unsigned char *frame, int len, DeltaMsg *msg) {
+    if (len < DELTA_FRAME_SIZE - CLOCKS_SIZE || frame[1] != PROTO_BINARY || frame[2] != MSG_DELTA) return -1;
+    const unsigned char *p = frame + FRAME_HEADER_SIZE;
+    if (p[4] >= CELL_COUNT) return -1;
+    msg->seq = get_u32(p);
+    msg->row = p[4] / BOARD_SIZE;
+    msg->col = p[4] % BOARD_SIZE;
+    msg->colour = p[5];
+    msg->next_player = p[6];
+    get_clocks(frame, DELTA_FRAME_SIZE - CLOCKS_SIZE, &msg->clocks);
+    return 0;
+}
+
+int decode_board_text(const char *text, int len, BoardMsg *msg) {
+    const char *end = text + len;
+    char *next;
+    if (len < 6 || strncmp(text, "BOARD", 5) != 0) return -1;
+    text += 5;
+    msg->current_player = strtol(text, &next, 10); text = next;
+    msg->move_state = strtol(text, &next, 10); text = next;
+    int *cells = &msg->board[0][0];
+    for (int i = 0; i < CELL_COUNT; i++) {
+        // Cells are single digits separated by blanks
+        while (text < end && (*text == ' ' || *text == '\n')) text++;
+        if (text >= end) return -1;
+        cells[i] = *text++ - '0';
+    }
+    msg->black_score = strtol(text, &next, 10); text = next;
+    msg->white_score = strtol(text, &next, 10);
+    msg->seq = 0;
+    if (next > end) return -1;
+    // The clocks follow the scores, unless the sender predates them
+    text = next;
+    msg->clocks.ms[0] = strtoul(text, &next, 10);
+    if (next == text || next > end) {
+        msg->clocks.ms[0] = msg->clocks.ms[1] = NO_CLOCK;
+        msg->clocks.periods[0] = msg->clocks.periods[1] = 0;
+        return 0;
+    }
+    text = next;
+    msg->clocks.ms[1] = strtoul(text, &next, 10); text = next;
+    msg->clocks.periods[0] = strtol(text, &next, 10); text = next;
+    msg->clocks.periods[1] = strtol(text, &next, 10);
+    return next > end ? -1 : 0;
+}
+
+int encode_text(unsigned char *out, const char *text, int len) {
+    put_header(out, MSG_TEXT, len);
+    memcpy(out + FRAME_HEADER_SIZE, text, len);
+    return FRAME_HEADER_SIZE + len;
+}
+
+int send_text(int fd, const char *text) {
+    unsigned char frame[FRAME_HEADER_SIZE + TEXT_MAX];
+    int len = strlen(text);
+    if (len > TEXT_MAX) return -1;
+    len = encode_text(frame, text, len);
+    return write(fd, frame, len) == len ? 0 : -1;
+}
+
+int frame_length(const unsigned char *header) {
+    if (header[0] != PROTO_MAGIC || header[1] != PROTO_BINARY) return -1;
+    return FRAME_HEADER_SIZE + (header[3] | header[4] << 8);
+}
@@ -0,0 +1,74 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "commun.h"
+
+// Board encodings a connection can negotiate with "PROTO <version>"
+#define PROTO_TEXT 0        // Text fallback: "BOARD p s \n" followed by 225 cells and the scores
+#define PROTO_BINARY 2      // Binary boards, current version: full boards plus sequence-numbered deltas
+
+// Every message in both directions is a frame: magic, version, message type,
+// payload length (16-bit little endian), payload
+#define PROTO_MAGIC 0xB5
+#define FRAME_HEADER_SIZE 5
+#define MSG_BOARD 1         // Full snapshot
+#define MSG_DELTA 2         // One stone placed since the previous sequence number
+#define MSG_TEXT 3          // Text message or command, e.g. "MOVE 7 7", "VOTE 1 0 1 30" or a text BOARD
+
+#define CELL_COUNT (BOARD_SIZE * BOARD_SIZE)
+#define PACKED_BOARD_SIZE ((CELL_COUNT * 2 + 7) / 8)            // 2 bits per cell: 57 bytes
+#define CLOCKS_SIZE 10                                          // Both clocks: ms left and byo-yomi periods
+#define BOARD_PAYLOAD_SIZE (PACKED_BOARD_SIZE + 10 + CLOCKS_SIZE) // + turn, state, both scores, sequence, clocks
+#define BOARD_FRAME_SIZE (FRAME_HEADER_SIZE + BOARD_PAYLOAD_SIZE)
+#define DELTA_PAYLOAD_SIZE (7 + CLOCKS_SIZE)                     // Sequence, cell, colour, next player, clocks
+#define DELTA_FRAME_SIZE (FRAME_HEADER_SIZE + DELTA_PAYLOAD_SIZE)
+#define TEXT_BOARD_MAX 1024
+#define TEXT_MAX 256                                            // Longest text message other than a board
+
+#define NO_CLOCK 0xFFFFFFFFu  // Clock value of a room without time control
+
+// Both players' clocks when the message was sent: ms left in the main time, or in the current
+// byo-yomi period once it is used up, and the byo-yomi periods left. Only the player to move's
+// clock is running.
+typedef struct {
+    unsigned ms[2];                        // ms[0] is black's
+    int periods[2];
+} Clocks;
+
+// Decoded BOARD message, whichever encoding it arrived in
+typedef struct {
+    int board[BOARD_SIZE][BOARD_SIZE];
+    int current_player, move_state, black_score, white_score;
+    unsigned seq;                          // Sequence number of the last delta included (binary only)
+    Clocks clocks;
+} BoardMsg;
+
+// Decoded DELTA message: the stone placed by update number seq
+typedef struct {
+    unsigned seq;
+    int row, col, colour, next_player;
+    Clocks clocks;
+} DeltaMsg;
+
+// Encode a BOARD message, return its length in bytes
+int encode_board_binary(unsigned char *out, const BoardMsg *msg);
+int encode_board_text(char *out, const BoardMsg *msg);
+
+// Decode a complete BOARD message, return 0 on success and -1 if it is malformed
+int decode_board_binary(const unsigned char *frame, int len, BoardMsg *msg);
+int decode_board_text(const char *text, int len, BoardMsg *msg);
+
+// Encode a DELTA frame (binary only) / decode it, same conventions as the BOARD functions
+int encode_delta(unsigned char *out, const DeltaMsg *msg);
+int decode_delta(const unsigned char *frame, int len, DeltaMsg *msg);
+
+// Frame a text message, return the frame length
+int encode_text(unsigned char *out, const char *text, int len);
+
+// Send a text command as one frame on a blocking socket, return -1 on a short write
+int send_text(int fd, const char *text);
+
+// Total length of a frame from its header, -1 if the header is not a valid frame header
+int frame_length(const unsigned char *header);
+
+#endif
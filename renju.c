@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include "renju.h"
+
+// Classification of a line window for a black stone on its centre
+#define P_FIVE 1
+#define P_OVERLINE 2
+#define P_FOURS_SHIFT 2     // Bits 2-3: number of fours (a straight four counts once)
+#define P_OPEN_THREE 16
+
+static const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+static uint8_t patterns[RENJU_PATTERNS];
+static RenjuBoard empty_board;
+static uint32_t powers[RENJU_SPAN];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// Length of the black run through position at
+static int run_at(const int *cells, int at) {
+    int l = at, r = at;
+    while (l > 0 && cells[l - 1] == BLACK) l--;
+    while (r < RENJU_SPAN - 1 && cells[r + 1] == BLACK) r++;
+    return r - l + 1;
+}
+
+// Empty cells completing exactly five through the centre, return how many (at most 2 kept)
+static int completions(int *cells, int *out) {
+    int count = 0;
+    for (int e = 0; e < RENJU_SPAN; e++) {
+        if (cells[e] != EMPTY) continue;
+        cells[e] = BLACK;
+        if (run_at(cells, RENJU_WINDOW) == 5) {
+            if (count < 2) out[count] = e;
+            count++;
+        }
+        cells[e] = EMPTY;
+    }
+    return count;
+}
+
+// Two completions five apart are the two ends of one straight four
+static int is_straight(int count, const int *at) { return count == 2 && at[1] - at[0] == 5; }
+
+static uint8_t classify(int *cells) {
+    int at[2], run = run_at(cells, RENJU_WINDOW);
+    if (run == 5) return P_FIVE;
+    if (run > 5) return P_OVERLINE;
+    int fours = completions(cells, at);
+    if (fours) return (is_straight(fours, at) ? 1 : fours > 2 ? 2 : fours) << P_FOURS_SHIFT;
+    for (int e = 0; e < RENJU_SPAN; e++) {
+        if (cells[e] != EMPTY) continue;
+        cells[e] = BLACK;
+        int count = run_at(cells, e) <= 5 ? completions(cells, at) : 0;
+        cells[e] = EMPTY;
+        if (is_straight(count, at)) return P_OPEN_THREE;
+    }
+    return 0;
+}
+
+static void build_tables(void) {
+    int cells[RENJU_SPAN];
+    powers[0] = 1;
+    for (int i = 1; i < RENJU_SPAN; i++) powers[i] = powers[i - 1] * 3;
+    for (uint32_t p = 0; p < RENJU_PATTERNS; p++) {
+        for (int i = 0, v = p; i < RENJU_SPAN; i++, v /= 3) cells[i] = v % 3;
+        // Only windows with an empty centre are looked up
+        if (cells[RENJU_WINDOW] != EMPTY) continue;
+        cells[RENJU_WINDOW] = BLACK;
+        patterns[p] = classify(cells);
+    }
+    // Positions off the board hold WHITE for good
+    for (int row = 0; row < BOARD_SIZE; row++)
+        for (int col = 0; col < BOARD_SIZE; col++)
+            for (int d = 0; d < 4; d++) {
+                uint32_t index = 0;
+                for (int i = 0; i < RENJU_SPAN; i++) {
+                    int r = row + (i - RENJU_WINDOW) * directions[d][0], c = col + (i - RENJU_WINDOW) * directions[d][1];
+                    if (r < 0 || r >= BOARD_SIZE || c < 0 || c >= BOARD_SIZE) index += WHITE * powers[i];
+                }
+                empty_board.index[row * BOARD_SIZE + col][d] = index;
+            }
+}
+
+void renju_clear(RenjuBoard *rb) {
+    pthread_once(&tables_once, build_tables);
+    *rb = empty_board;
+}
+
+void renju_place(RenjuBoard *rb, int row, int col, int colour) {
+    for (int d = 0; d < 4; d++)
+        for (int i = 0; i < RENJU_SPAN; i++) {
+            // The stone sits at position i of the window centred RENJU_WINDOW - i steps away
+            int r = row - (i - RENJU_WINDOW) * directions[d][0], c = col - (i - RENJU_WINDOW) * directions[d][1];
+            if (r >= 0 && r < BOARD_SIZE && c >= 0 && c < BOARD_SIZE) rb->index[r * BOARD_SIZE + c][d] += colour * powers[i];
+        }
+}
+
+int renju_check(const RenjuBoard *rb, int row, int col) {
+    const uint32_t *index = rb->index[row * BOARD_SIZE + col];
+    int five = 0, overline = 0, fours = 0, threes = 0;
+    for (int d = 0; d < 4; d++) {
+        uint8_t p = patterns[index[d]];
+        five |= p & P_FIVE;
+        overline |= p & P_OVERLINE;
+        fours += (p >> P_FOURS_SHIFT) & 3;
+        threes += (p & P_OPEN_THREE) != 0;
+    }
+    if (five) return RENJU_FIVE;
+    return overline || fours >= 2 || threes >= 2 ? RENJU_FORBIDDEN : RENJU_OK;
+}
@@ -0,0 +1,39 @@
+#ifndef RENJU_H
+#define RENJU_H
+
+#include <stdint.h>
+#include "commun.h"
+
+// Rulesets a room can be created with
+#define RULES_FREESTYLE 0   // Five or more in a row wins, for both colours
+#define RULES_RENJU 1       // Black must make exactly five and may not make a double three,
+                            // a double four or an overline
+#define RULES_COUNT 2
+
+// Each cell keeps, for each of the four directions, the base-3 index of the 11 cells of its line
+// centred on it (EMPTY 0, BLACK 1, WHITE 2; off the board counts as WHITE, it blocks black the same)
+#define RENJU_WINDOW 5
+#define RENJU_SPAN (2 * RENJU_WINDOW + 1)
+#define RENJU_PATTERNS 177147              // 3^11
+
+// Verdict on a black move
+#define RENJU_OK 0
+#define RENJU_FIVE 1        // Exactly five: black wins, even if the move is otherwise forbidden
+#define RENJU_FORBIDDEN 2
+
+typedef struct {
+    uint32_t index[BOARD_SIZE * BOARD_SIZE][4];
+} RenjuBoard;
+
+// Empty board; builds the pattern tables on first use
+void renju_clear(RenjuBoard *rb);
+
+// Update the indices of the 44 cells whose windows hold the stone
+void renju_place(RenjuBoard *rb, int row, int col, int colour);
+
+// Judge a black stone on an empty cell from four table lookups, one per direction.
+// A three counts as open if one more stone on its line makes a straight four there;
+// whether that stone would itself be forbidden by the other lines is not checked.
+int renju_check(const RenjuBoard *rb, int row, int col);
+
+#endif
@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <sys/uio.h>
+#include "ring.h"
+#include "protocol.h"
+
+int ring_init(Ring *r, unsigned size) {
+    r->data = malloc(size);
+    r->size = size;
+    r->head = r->tail = 0;
+    return r->data ? 0 : -1;
+}
+
+void ring_free(Ring *r) {
+    free(r->data);
+    r->data = NULL;
+}
+
+// Split the `len` bytes starting at counter `from` into the contiguous parts of the storage
+static int ring_iov(const Ring *r, unsigned from, unsigned len, struct iovec iov[2]) {
+    unsigned start = from & (r->size - 1), first = r->size - start;
+    if (first > len) first = len;
+    iov[0].iov_base = r->data + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = r->data;
+    iov[1].iov_len = len - first;
+    return len > first ? 2 : 1;
+}
+
+static void ring_peek(const Ring *r, void *out, unsigned len) {
+    struct iovec iov[2];
+    ring_iov(r, r->head, len, iov);
+    memcpy(out, iov[0].iov_base, iov[0].iov_len);
+    memcpy((unsigned char *)out + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+}
+
+int ring_put(Ring *r, const void *data, unsigned len) {
+    struct iovec iov[2];
+    if (len > ring_space(r)) return -1;
+    ring_iov(r, r->tail, len, iov);
+    memcpy(iov[0].iov_base, data, iov[0].iov_len);
+    memcpy(iov[1].iov_base, (const unsigned char *)data + iov[0].iov_len, iov[1].iov_len);
+    r->tail += len;
+    return 0;
+}
+
+void ring_take(Ring *r, void *out, unsigned len) {
+    ring_peek(r, out, len);
+    r->head += len;
+}
+
+int ring_read(Ring *r, int fd) {
+    struct iovec iov[2];
+    int count = ring_iov(r, r->tail, ring_space(r), iov);
+    int n = readv(fd, iov, count);
+    if (n > 0) r->tail += n;
+    return n;
+}
+
+int ring_flush(Ring *r, int fd) {
+    struct iovec iov[2];
+    while (ring_used(r)) {
+        int n = writev(fd, iov, ring_iov(r, r->head, ring_used(r), iov));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? (int)ring_used(r) : -1;
+        }
+        r->head += n;
+    }
+    return 0;
+}
+
+int ring_frame_length(const Ring *r) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (ring_used(r) < FRAME_HEADER_SIZE) return 0;
+    ring_peek(r, header, FRAME_HEADER_SIZE);
+    int len = frame_length(header);
+    if (len < 0 || (unsigned)len > r->size) return -1;
+    return ring_used(r) >= (unsigned)len ? len : 0;
+}
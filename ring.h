@@ -0,0 +1,37 @@
+#ifndef RING_H
+#define RING_H
+
+// Byte ring buffer for a framed stream: the bytes received on a connection until they form
+// whole frames, or the messages queued for it until the event loop sends them all at once.
+// size is a power of two; head and tail count bytes forever and wrap with the mask.
+typedef struct {
+    unsigned char *data;
+    unsigned size, head, tail;             // Bytes [head, tail) are buffered
+} Ring;
+
+static inline unsigned ring_used(const Ring *r) { return r->tail - r->head; }
+
+static inline unsigned ring_space(const Ring *r) { return r->size - (r->tail - r->head); }
+
+// Allocate the storage, return -1 if it cannot be
+int ring_init(Ring *r, unsigned size);
+void ring_free(Ring *r);
+static inline void ring_reset(Ring *r) { r->head = r->tail = 0; }
+
+// Append len bytes; return -1 and append nothing if they do not fit
+int ring_put(Ring *r, const void *data, unsigned len);
+
+// Copy the first len bytes out and consume them
+void ring_take(Ring *r, void *out, unsigned len);
+
+// read() into the free space (both parts of it if it wraps), same return value as read()
+int ring_read(Ring *r, int fd);
+
+// writev() the buffered bytes; return how many are still buffered, -1 on a socket error
+int ring_flush(Ring *r, int fd);
+
+// Length of the complete frame at the front, 0 if it has not fully arrived yet,
+// -1 if the stream does not start with a valid frame header or the frame can never fit
+int ring_frame_length(const Ring *r);
+
+#endif
@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "gomoku.h"
+#include "engine.h"
+
+#define CELLS (BOARD_SIZE * BOARD_SIZE)
+#define LENGTH_BUCKETS (CELLS + 1)
+#define CHUNK 64            // Games a thread takes at a time
+
+// How one side picks its moves
+#define POLICY_RANDOM 0     // Any empty cell next to a stone
+#define POLICY_GREEDY 1     // Win if it can, block the opponent's five, otherwise random
+#define POLICY_ENGINE 2     // The server's search, single-threaded, budget_ms per move
+
+typedef struct {
+    int kind, budget_ms;
+} Policy;
+
+// Totals of one thread, added up at the end
+typedef struct {
+    long games, moves, wins[3];            // wins[EMPTY] counts the draws
+    long forbidden;                        // Moves Renju refused, each one retried
+    long lengths[LENGTH_BUCKETS];          // Games by number of moves
+} Stats;
+
+// Games shared by the threads: each takes the next CHUNK numbers until all are played
+typedef struct {
+    long games;
+    atomic_long next;
+    int rules;
+    Policy policies[2];                    // policies[0] plays black
+    uint64_t seed;
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    Stats stats;
+} Worker;
+
+static Bitset on_board;
+
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void empty_cells(const Game *game, Bitset *out) {
+    for (int i = 0; i < BB_WORDS; i++)
+        out->w[i] = on_board.w[i] & ~(game->board.stones[0].w[i] | game->board.stones[1].w[i]);
+}
+
+// Empty cells next to a stone, the centre on an empty board
+static void candidates(const Game *game, Bitset *out) {
+    static const int steps[4] = {1, BB_STRIDE - 1, BB_STRIDE, BB_STRIDE + 1};
+    Bitset occupied, shifted, empty;
+    for (int i = 0; i < BB_WORDS; i++) {
+        occupied.w[i] = game->board.stones[0].w[i] | game->board.stones[1].w[i];
+        out->w[i] = 0;
+    }
+    if (!game->moves) {
+        bs_set(out, bb_index(BOARD_SIZE / 2, BOARD_SIZE / 2));
+        return;
+    }
+    for (int d = 0; d < 4; d++) {
+        bs_shl(&occupied, steps[d], &shifted);
+        for (int i = 0; i < BB_WORDS; i++) out->w[i] |= shifted.w[i];
+        bs_shr(&occupied, steps[d], &shifted);
+        for (int i = 0; i < BB_WORDS; i++) out->w[i] |= shifted.w[i];
+    }
+    empty_cells(game, &empty);
+    for (int i = 0; i < BB_WORDS; i++) out->w[i] &= empty.w[i];
+}
+
+// Bit index of the n-th set bit
+static int nth_bit(const Bitset *b, int n) {
+    for (int i = 0; i < BB_WORDS; i++) {
+        int count = __builtin_popcountll(b->w[i]);
+        if (n < count) {
+            uint64_t w = b->w[i];
+            while (n--) w &= w - 1;
+            return i * 64 + __builtin_ctzll(w);
+        }
+        n -= count;
+    }
+    return -1;
+}
+
+static int random_cell(const Bitset *cells, uint64_t *rng) {
+    int count = bs_count(cells);
+    return count ? nth_bit(cells, splitmix64(rng) % count) : -1;
+}
+
+// A winning cell for the player to move, else one where the opponent would win, else random
+static int greedy_cell(const Game *game, const Bitset *cells, uint64_t *rng) {
+    int colour = game->current_player, opponent = colour == BLACK ? WHITE : BLACK, block = -1;
+    for (int i = 0; i < BB_WORDS; i++)
+        for (uint64_t w = cells->w[i]; w; w &= w - 1) {
+            int cell = i * 64 + __builtin_ctzll(w), row = cell / BB_STRIDE, col = cell % BB_STRIDE;
+            if (game_check(game, row, col, colour) == GAME_WIN) return cell;
+            if (block < 0 && game_check(game, row, col, opponent) == GAME_WIN) block = cell;
+        }
+    return block >= 0 ? block : random_cell(cells, rng);
+}
+
+// Choose among the cells not refused yet for the player to move; -1 if none is left
+static int choose(const Game *game, const Policy *policy, const Bitset *cells, uint64_t *rng) {
+    if (policy->kind == POLICY_ENGINE) {
+        EngineResult result;
+        engine_search(&game->board, game->current_player, policy->budget_ms, 1, &result);
+        // The engine does not know Renju: once its move is refused, the greedy choice stands in
+        if (result.row >= 0 && bs_test(cells, bb_index(result.row, result.col))) return bb_index(result.row, result.col);
+    }
+    if (policy->kind == POLICY_RANDOM) return random_cell(cells, rng);
+    return greedy_cell(game, cells, rng);
+}
+
+// Play one game to its end and return the winner, EMPTY for a draw
+static int play_game(Game *game, const Policy policies[2], uint64_t rng, Stats *stats) {
+    game_reset(game);
+    while (1) {
+        int colour = game->current_player, result = GAME_FORBIDDEN, widened = 0;
+        Bitset cells, refused = {{0}};
+        candidates(game, &cells);
+        while (result == GAME_FORBIDDEN) {
+            // Every cell near the stones was refused: try the rest of the board once
+            if (!bs_count(&cells) && !widened) {
+                widened = 1;
+                empty_cells(game, &cells);
+                for (int i = 0; i < BB_WORDS; i++) cells.w[i] &= ~refused.w[i];
+            }
+            int cell = choose(game, &policies[colour - 1], &cells, &rng);
+            // Renju forbids every cell left to black
+            if (cell < 0) return EMPTY;
+            result = game_play(game, cell / BB_STRIDE, cell % BB_STRIDE);
+            if (result == GAME_FORBIDDEN) {
+                stats->forbidden++;
+                bs_clear(&cells, cell);
+                bs_set(&refused, cell);
+            }
+        }
+        if (result == GAME_WIN) return colour;
+        if (result == GAME_DRAW) return EMPTY;
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    Batch *batch = worker->batch;
+    Stats *stats = &worker->stats;
+    Game game;
+    game_init(&game, batch->rules);
+    long first;
+    while ((first = atomic_fetch_add(&batch->next, CHUNK)) < batch->games) {
+        long last = first + CHUNK < batch->games ? first + CHUNK : batch->games;
+        for (long n = first; n < last; n++) {
+            // Each game has its own seed: the results do not depend on the number of threads
+            uint64_t rng = batch->seed ^ (n * 0xD1B54A32D192ED03ULL);
+            int winner = play_game(&game, batch->policies, rng, stats);
+            stats->games++;
+            stats->moves += game.moves;
+            stats->wins[winner]++;
+            stats->lengths[game.moves]++;
+        }
+    }
+    game_free(&game);
+    return NULL;
+}
+
+// "random", "greedy" or "engine[:ms]"
+static int parse_policy(const char *text, Policy *policy) {
+    policy->budget_ms = 10;
+    if (strcmp(text, "random") == 0) policy->kind = POLICY_RANDOM;
+    else if (strcmp(text, "greedy") == 0) policy->kind = POLICY_GREEDY;
+    else if (strncmp(text, "engine", 6) == 0 && (!text[6] || (text[6] == ':' && atoi(text + 7) > 0))) {
+        policy->kind = POLICY_ENGINE;
+        if (text[6]) policy->budget_ms = atoi(text + 7);
+    } else return -1;
+    return 0;
+}
+
+// Length below which the given share of the games ended
+static int length_percentile(const Stats *stats, double share) {
+    long seen = 0;
+    for (int i = 0; i < LENGTH_BUCKETS; i++)
+        if ((seen += stats->lengths[i]) >= share * stats->games) return i;
+    return CELLS;
+}
+
+// Play a batch of games between two policies on every core, then print who won and how long
+// the games lasted
+int main(int argc, char *argv[]) {
+    static Batch batch;
+    static Stats total;
+    const char *names[2] = {"greedy", "greedy"};
+    int opt, threads = sysconf(_SC_NPROCESSORS_ONLN);
+    batch.games = 100000;
+    batch.seed = time(NULL);
+    while ((opt = getopt(argc, argv, "b:w:n:t:s:R")) != -1) {
+        if (opt == 'b') names[0] = optarg;
+        else if (opt == 'w') names[1] = optarg;
+        else if (opt == 'n' && atol(optarg) > 0) batch.games = atol(optarg);
+        else if (opt == 't' && atoi(optarg) > 0) threads = atoi(optarg);
+        else if (opt == 's') batch.seed = strtoull(optarg, NULL, 10);
+        else if (opt == 'R') batch.rules = RULES_RENJU;
+        else {
+            fprintf(stderr, "Usage: %s [-b black policy] [-w white policy] [-n games] [-t threads] [-s seed] [-R]\n"
+                            "Policies: random, greedy (default), engine[:ms per move]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (int c = 0; c < 2; c++)
+        if (parse_policy(names[c], &batch.policies[c]) < 0) {
+            fprintf(stderr, "Unknown policy %s\n", names[c]);
+            return 1;
+        }
+    if (threads < 1) threads = 1;
+    for (int row = 0; row < BOARD_SIZE; row++)
+        for (int col = 0; col < BOARD_SIZE; col++) bs_set(&on_board, bb_index(row, col));
+
+    struct timespec start, end;
+    Worker *workers = calloc(threads, sizeof(Worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; i++) {
+        workers[i].batch = &batch;
+        pthread_create(&tids[i], NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        Stats *stats = &workers[i].stats;
+        total.games += stats->games;
+        total.moves += stats->moves;
+        total.forbidden += stats->forbidden;
+        for (int c = 0; c < 3; c++) total.wins[c] += stats->wins[c];
+        for (int l = 0; l < LENGTH_BUCKETS; l++) total.lengths[l] += stats->lengths[l];
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%s (black) vs %s (white), %s rules, seed %llu\n", names[0], names[1],
+           batch.rules == RULES_RENJU ? "Renju" : "freestyle", (unsigned long long)batch.seed);
+    printf("%ld games, %ld moves\n", total.games, total.moves);
+    printf("Black won %.1f%%, white %.1f%%, draws %.1f%%\n", 100.0 * total.wins[BLACK] / total.games,
+           100.0 * total.wins[WHITE] / total.games, 100.0 * total.wins[EMPTY] / total.games);
+    printf("Game length: average %.1f, p50 %d, p90 %d, p99 %d moves\n", (double)total.moves / total.games,
+           length_percentile(&total, 0.5), length_percentile(&total, 0.9), length_percentile(&total, 0.99));
+    if (batch.rules == RULES_RENJU) printf("Forbidden moves refused: %ld\n", total.forbidden);
+    printf("Played in %.3f s on %d threads: %.0f games/s, %.0f moves/s\n", seconds, threads,
+           total.games / seconds, total.moves / seconds);
+    return 0;
+}
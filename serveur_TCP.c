@@ -1,149 +1,1455 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-
-#define BOARD_SIZE 15   // Board size is 15x15
-#define EMPTY 0         // Empty cell
-#define BLACK 1         // Black stone
-#define WHITE 2         // White stone
-#define PORT 12345      // Listening port
-
-// Game state structure, stores board, current turn, two player sockets, scores, etc.
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include "protocol.h"
+#include "ring.h"
+#include "gomoku.h"
+#include "engine.h"
+#include "lobby.h"
+#include "journal.h"
+#include "metrics.h"
+#include "log.h"
+#include "wheel.h"
+
+#define MAX_EVENTS 256  // Events handled per epoll_wait() call
+#define CONN_BUF_SIZE 512 // Per-connection ring of received bytes, a command frame must fit in it
+#define CONN_OUT_SIZE 4096 // Per-connection queue of messages waiting for the next flush
+#define AI_BUDGET_MS 1000 // Thinking time of the server's engine per move
+#define VOTE_TIMEOUT 30   // Default seconds given to vote, a missing vote counts as "n"
+#define SPEC_QUEUE 64     // Updates a spectator may fall behind before it skips to a snapshot
+
+#define ROOM_PLAYING 0  // Room is waiting for the current player's move
+#define ROOM_VOTING 1   // Game is over, room is collecting the replay votes
+#define ROOM_RESUMING 2 // Recovered from the journal, waiting for its players to come back
+
+// Reasons a move is refused, besides GAME_ILLEGAL and GAME_FORBIDDEN
+#define MOVE_LATE -3    // The player's time ran out before the move arrived
+#define MOVE_TURN -4    // Not the sender's turn, or no game in progress
+
+// Clock of every game: main time, then a Fischer increment added after each move, or
+// byo-yomi periods once the main time is used up. main_ms is 0 for untimed games.
+typedef struct {
+    int main_ms, increment_ms, byoyomi_ms, periods;
+} TimeControl;
+
+// What a player has left; a byo-yomi period is only lost when it runs out entirely
+typedef struct {
+    int left_ms, periods;
+} PlayerClock;
+
+typedef struct Room Room;
+typedef struct Server Server;
+typedef struct Cluster Cluster;
+
+// Message serialized once and queued to any number of spectators without copying,
+// freed once the last queue holding it has sent it
+typedef struct {
+    int refs, len;
+    unsigned char data[];
+} Shared;
+
+// Connection state: socket, the room it plays in, the bytes received but not yet handled
+// and the messages not sent yet
+typedef struct Conn {
+    int fd, player;                        // fd is -1 once closed, player is BLACK or WHITE once seated
+    int proto;                             // Board encoding negotiated with PROTO, PROTO_TEXT by default
+    Room *room;
+    struct Conn *next_dead;                // Link in the list of connections freed after the current batch
+    struct Conn *next_flush;               // Link in the list of connections with messages to send
+    int flush_queued, want_write;          // In the flush list / waiting for EPOLLOUT
+    Ring in, out;
+    int home;                              // Worker that accepted the connection
+    int moving;                            // Handed to another worker, this one ignores its events
+    char name[NAME_SIZE];                  // From "PLAY name", empty for an anonymous player
+    int rules;                             // Ruleset asked for with RULES, RULES_FREESTYLE by default
+    int rating;                            // When the player joined the lobby
+    unsigned token;                        // Seat token quoted by RESUME
+    LobbyEntry lobby;
+    // Spectators watch a room read-only and only receive Shared messages, never `out`
+    int spectator;
+    struct Conn *spec_prev, *spec_next;    // Links in the room's spectators, or the server's pending ones
+    Shared *refs[SPEC_QUEUE];              // refs[ref_head % SPEC_QUEUE] is sent first
+    unsigned ref_head, ref_tail, ref_off;  // ref_off bytes of the first message are already sent
+} Conn;
+
+// A room hosts one match between two connections, watched by any number of spectators
+struct Room {
+    int id;
+    Game game;                             // Board, rules and turn of the game in progress
+    int black_score, white_score, move_state;
+    Conn *players[2];                      // players[0] is black, players[1] is white
+    Conn *spectators;
+    int spectator_count;
+    Room *prev, *next;                     // Links in the server's list of rooms, newest first
+    int state, winner, draws;
+    char votes[2];                         // 0 while the player has not voted yet
+    unsigned seq;                          // Number of the last delta broadcast in this room
+    int ai_colour;                         // Colour played by the server's engine, EMPTY between humans
+    int ai_busy, closed;                   // A closed room is freed once its pending search returns
+    int recovered;                         // Rebuilt from the journal, its players are not rated
+    unsigned tokens[2];                    // Secret RESUME must quote for each human seat, 0 for the engine's
+    int ratings[2];                        // Of the seated players when the room was created
+    uint64_t vote_deadline;                // ms, while voting or resuming
+    uint64_t vote_start_ns;
+    TimeControl time;
+    PlayerClock clocks[2];                 // clocks[0] is black's
+    uint64_t turn_start;                   // ms, when the running clock started
+    Timer flag;                            // Armed while a human player's clock runs
+    Room *vote_prev, *vote_next;           // Links in the server's list of voting (or resuming) rooms
+};
+
+// Search handed to the AI threads; the result comes back to the room's worker
+typedef struct AiJob {
+    Server *owner;
+    Room *room;
+    unsigned seq;                          // Room sequence at submission, a stale result is dropped
+    Bitboard board;
+    int colour;
+    EngineResult result;
+    struct AiJob *next;
+} AiJob;
+
+// Engine threads: they take jobs from `todo` and hand each result to the worker of its room
 typedef struct {
-    int board[BOARD_SIZE][BOARD_SIZE];
-    int current_player, socket1, socket2, black_score, white_score;
-    int move_state, stone_count[2];
-} GameState;
-
-// Initialize board and related state
-void init_board(GameState *game) {
-    memset(game->board, EMPTY, sizeof(game->board));
-    game->current_player = BLACK;
-    game->move_state = 0;
-    game->stone_count[0] = game->stone_count[1] = 0;
-}
-
-// Pack current board state, turn, and score, then send to both players
-void send_board(GameState *game) {
-    char buffer[1024];
-    static int count = 0;
-    int len = sprintf(buffer, "BOARD %d %d \n", game->current_player, game->move_state);
-    for (int i = 0; i < BOARD_SIZE; i++)
-        for (int j = 0; j < BOARD_SIZE; j++)
-            len += sprintf(buffer + len, "%d ", game->board[i][j]);
-    len += sprintf(buffer + len, "%d %d\n", game->black_score, game->white_score);
-    write(game->socket1, buffer, len);
-    write(game->socket2, buffer, len);
-    printf("Sending board to both players... n.%d\n", ++count);
-}
-
-// Check if placing a stone at the current position forms five in a row (win condition)
-int check_win(GameState *game, int row, int col) {
-    int player = game->board[row][col], dirs[4][2] = {{1,0}, {0,1}, {1,1}, {1,-1}};
-    for (int d = 0; d < 4; d++) {
-        int count = 1, dx = dirs[d][0], dy = dirs[d][1];
-        // Search in the forward direction
-        for (int i = 1; i < 5; i++) {
-            int r = row + dx * i, c = col + dy * i;
-            if (r < 0 || r >= BOARD_SIZE || c < 0 || c >= BOARD_SIZE || game->board[r][c] != player) break;
-            count++;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AiJob *todo, *todo_tail;
+    int searching, cores;
+} AiPool;
+
+#define HANDOFF_LOBBY 0 // A connection that sent PLAY, for the lobby on worker 0
+#define HANDOFF_ROOM 1  // Two paired players to seat in a new room
+#define HANDOFF_WATCH 2 // A spectator for one of the receiving worker's rooms
+#define HANDOFF_AI 3    // A finished search
+#define HANDOFF_RATING 4 // A player's new rating, for the table on worker 0
+#define HANDOFF_RESUME 5 // A player taking its seat back in one of the receiving worker's rooms
+
+// Message passed to a worker through its inbox
+typedef struct Handoff {
+    int type;
+    Conn *conn, *partner;                  // HANDOFF_ROOM: black and white
+    int room_id;                           // HANDOFF_WATCH and HANDOFF_RESUME
+    AiJob *job;                            // HANDOFF_AI
+    char name[NAME_SIZE];                  // HANDOFF_RATING
+    int rating;
+    Server *target;                        // Worker it goes to once it leaves the outbox
+    struct Handoff *next;
+} Handoff;
+
+// One event loop. Each worker thread runs its own: a listening socket on PORT (SO_REUSEPORT
+// spreads the connections), an epoll instance, connections and rooms. Connections and rooms
+// belong to exactly one worker; workers only talk through their lock-free inboxes.
+struct Server {
+    int index, listen_fd, epoll_fd;
+    Cluster *cluster;
+    _Atomic(Handoff *) inbox;              // Pushed by any thread, drained by this worker only
+    int inbox_fd;                          // eventfd waking the worker up when a message arrives
+    Handoff *outbox;                       // Sent once the current batch is flushed
+    Lobby *lobby;                          // Worker 0 only: players waiting for an opponent, one lobby per ruleset
+    RatingTable *ratings;                  // Worker 0 only
+    Conn *watchers;                        // Spectators waiting for the next room to be created
+    Room *rooms;
+    int next_room_id;
+    Conn *dead;
+    Conn *flush;                           // Connections that queued messages since the last flush
+    int room_count;
+    // Rooms collecting votes. Every vote gets the same timeout, so the list is in deadline order.
+    Room *vote_head, *vote_tail;
+    int vote_timeout_ms;
+    Wheel wheel;                           // Flag-fall timers of the rooms of this worker
+    JournalBatch *journal_batch;           // Records of the current batch, on disk before the flush
+    int journal_fd;                        // eventfd the journal writer posts once that batch is synced
+    Metrics metrics;
+    uint64_t batch_ns;                     // When epoll_wait returned the current batch
+    int batch_moves;                       // Moves played in the current batch
+    MetricsSnapshot *dumped;               // Worker 0 with -s: the metrics at the last dump
+    uint64_t dump_ns;
+};
+
+// The workers and the engine threads they share
+struct Cluster {
+    Server *workers;
+    int count;
+    AiPool ai;
+    Journal *journal;                      // NULL unless the server was started with -j
+    int stats_ms;                          // Period of the metrics dump, 0 for none
+    TimeControl time;                      // From -c, for every new room
+};
+
+uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Append a record about a room to this worker's batch of journal records
+void journal_room(Server *server, Room *room, int type, int cell, int colour) {
+    Journal *journal = server->cluster->journal;
+    if (journal) journal_add(journal, &server->journal_batch, type, room->id, room->seq, cell, colour);
+}
+
+// Create a room playing by the given rules
+Room *room_new(int rules) {
+    Room *room = calloc(1, sizeof(Room));
+    game_init(&room->game, rules);
+    return room;
+}
+
+void room_free(Room *room) {
+    game_free(&room->game);
+    free(room);
+}
+
+// Spend elapsed ms of a clock: the main time first, then whole byo-yomi periods.
+// Return the ms left in the current stage, 0 once the time is up.
+int clock_spend(const TimeControl *time, PlayerClock *clock, uint64_t elapsed) {
+    if (elapsed < (uint64_t)clock->left_ms) {
+        clock->left_ms -= elapsed;
+        return clock->left_ms;
+    }
+    elapsed -= clock->left_ms;
+    clock->left_ms = 0;
+    if (!time->byoyomi_ms) return 0;
+    int used = elapsed / time->byoyomi_ms;
+    clock->periods = used < clock->periods ? clock->periods - used : 0;
+    return clock->periods ? time->byoyomi_ms - (int)(elapsed % time->byoyomi_ms) : 0;
+}
+
+// Both clocks as the clients see them, the running one counted down to now
+void room_clocks(Room *room, Clocks *out) {
+    for (int i = 0; i < 2; i++) {
+        PlayerClock clock = room->clocks[i];
+        if (!room->time.main_ms) out->ms[i] = NO_CLOCK;
+        else if (timer_armed(&room->flag) && room->game.current_player == i + 1)
+            out->ms[i] = clock_spend(&room->time, &clock, now_ms() - room->turn_start);
+        else out->ms[i] = clock.left_ms || !clock.periods ? clock.left_ms : room->time.byoyomi_ms;
+        out->periods[i] = clock.periods;
+    }
+}
+
+// Full time for both players at the start of a game
+void reset_clocks(Room *room) {
+    for (int i = 0; i < 2; i++) {
+        room->clocks[i].left_ms = room->time.main_ms;
+        room->clocks[i].periods = room->time.byoyomi_ms ? room->time.periods : 0;
+    }
+}
+
+// ms a clock can run before its flag falls
+uint64_t clock_budget(Room *room, const PlayerClock *clock) {
+    return clock->left_ms + (uint64_t)clock->periods * room->time.byoyomi_ms;
+}
+
+// Start the clock of the player to move; the engine plays untimed
+void start_clock(Server *server, Room *room) {
+    int player = room->game.current_player;
+    if (!room->time.main_ms || room->state != ROOM_PLAYING || player == EMPTY || player == room->ai_colour) return;
+    room->turn_start = now_ms();
+    wheel_add(&server->wheel, &room->flag, room->turn_start + clock_budget(room, &room->clocks[player - 1]));
+}
+
+// 1 if the running clock is past its flag, which the wheel only notices on its next tick
+int clock_expired(Room *room) {
+    if (!timer_armed(&room->flag)) return 0;
+    return now_ms() - room->turn_start >= clock_budget(room, &room->clocks[room->game.current_player - 1]);
+}
+
+// Charge a player for the move just played and add the increment
+void stop_clock(Server *server, Room *room, int player) {
+    if (!timer_armed(&room->flag)) return;
+    wheel_cancel(&server->wheel, &room->flag);
+    PlayerClock *clock = &room->clocks[player - 1];
+    clock_spend(&room->time, clock, now_ms() - room->turn_start);
+    clock->left_ms += room->time.increment_ms;
+}
+
+// Add a connection to the list flushed after the current batch
+void mark_flush(Server *server, Conn *conn) {
+    if (conn->flush_queued) return;
+    conn->flush_queued = 1;
+    conn->next_flush = server->flush;
+    server->flush = conn;
+}
+
+// Queue a message for a connection; the event loop sends everything queued during a batch
+// with one writev() per connection. A peer that lets its queue fill up does not drain its
+// socket: it is shut down instead of holding memory and the room.
+void queue_msg(Server *server, Conn *conn, const void *data, int len) {
+    if (conn->fd < 0) return;
+    if (ring_put(&conn->out, data, len) < 0) {
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    mark_flush(server, conn);
+}
+
+Shared *shared_new(const void *data, int len) {
+    Shared *msg = malloc(sizeof(Shared) + len);
+    msg->refs = 1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return msg;
+}
+
+void shared_put(Shared *msg) {
+    if (--msg->refs == 0) free(msg);
+}
+
+Shared *shared_text(const char *text) {
+    unsigned char frame[FRAME_HEADER_SIZE + TEXT_MAX];
+    return shared_new(frame, encode_text(frame, text, strlen(text)));
+}
+
+Shared *snapshot_shared(Room *room, int proto);
+
+// A spectator SPEC_QUEUE messages behind drops every message it has not started sending
+// and gets one snapshot of the current board instead, so it never holds the players back
+void skip_to_snapshot(Server *server, Conn *conn) {
+    unsigned keep = conn->ref_off ? 1 : 0;
+    while (conn->ref_tail - conn->ref_head > keep) shared_put(conn->refs[--conn->ref_tail % SPEC_QUEUE]);
+    if (!conn->room) return;
+    Shared *msg = snapshot_shared(conn->room, conn->proto);
+    conn->refs[conn->ref_tail++ % SPEC_QUEUE] = msg;
+}
+
+// Queue a shared message for a spectator by reference
+void queue_shared(Server *server, Conn *conn, Shared *msg) {
+    if (conn->fd < 0) return;
+    if (conn->ref_tail - conn->ref_head == SPEC_QUEUE) skip_to_snapshot(server, conn);
+    msg->refs++;
+    conn->refs[conn->ref_tail++ % SPEC_QUEUE] = msg;
+    mark_flush(server, conn);
+}
+
+// writev() a spectator's messages straight from the shared buffers;
+// return the bytes still queued, -1 on a socket error
+int flush_shared(Server *server, Conn *conn) {
+    struct iovec iov[SPEC_QUEUE];
+    while (conn->ref_head != conn->ref_tail) {
+        int count = 0, left = 0;
+        for (unsigned i = conn->ref_head; i != conn->ref_tail; i++, count++) {
+            Shared *msg = conn->refs[i % SPEC_QUEUE];
+            int off = i == conn->ref_head ? conn->ref_off : 0;
+            iov[count].iov_base = msg->data + off;
+            iov[count].iov_len = msg->len - off;
+            left += msg->len - off;
+        }
+        int n = writev(conn->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? left : -1;
         }
-        // Search in the backward direction
-        for (int i = 1; i < 5; i++) {
-            int r = row - dx * i, c = col - dy * i;
-            if (r < 0 || r >= BOARD_SIZE || c < 0 || c >= BOARD_SIZE || game->board[r][c] != player) break;
-            count++;
+        metric_add(&server->metrics, M_BYTES_OUT, n);
+        // Release the messages sent in full
+        while (n > 0) {
+            Shared *msg = conn->refs[conn->ref_head % SPEC_QUEUE];
+            if (n < msg->len - (int)conn->ref_off) {
+                conn->ref_off += n;
+                break;
+            }
+            n -= msg->len - conn->ref_off;
+            conn->ref_off = 0;
+            conn->ref_head++;
+            shared_put(msg);
         }
-        if (count >= 5) return 1;
     }
     return 0;
 }
 
-// Handle voting mechanism after game ends: return 1 if both players agree to play again
-int handle_voting(GameState *game, int winner) {
-    char buffer[64], votes[2];
-    sprintf(buffer, "VOTE %d %d %d\n", game->black_score, game->white_score, winner);
-    write(game->socket1, buffer, strlen(buffer));
-    write(game->socket2, buffer, strlen(buffer));
-    printf("Sent votes: %s to both players\n", buffer);
-    // Read votes from both players
-    read(game->socket1, votes, 1);
-    read(game->socket2, votes + 1, 1);
-    printf("Received votes: %s from both players\n", buffer);
-    int result = (votes[0] == 'y' && votes[1] == 'y');
-    printf("Voting result: %d\n", result);
+// Queue a text message in its frame
+void queue_text(Server *server, Conn *conn, const char *text) {
+    unsigned char frame[FRAME_HEADER_SIZE + TEXT_MAX];
+    queue_msg(server, conn, frame, encode_text(frame, text, strlen(text)));
+}
+
+// Send what a connection has queued; whatever the socket does not take waits for EPOLLOUT
+void flush_conn(Server *server, Conn *conn) {
+    if (conn->fd < 0) return;
+    int queued = ring_used(&conn->out);
+    int left = conn->spectator ? flush_shared(server, conn) : ring_flush(&conn->out, conn->fd);
+    if (left < 0) {
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    if (!conn->spectator) metric_add(&server->metrics, M_BYTES_OUT, queued - left);
+    if ((left > 0) != conn->want_write) {
+        conn->want_write = left > 0;
+        struct epoll_event ev = {EPOLLIN | (conn->want_write ? EPOLLOUT : 0), {.ptr = conn}};
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+}
+
+// Flush every connection that queued messages during the last batch
+void flush_conns(Server *server) {
+    while (server->flush) {
+        Conn *conn = server->flush;
+        server->flush = conn->next_flush;
+        conn->flush_queued = 0;
+        flush_conn(server, conn);
+    }
+}
+
+// Pack current board state, turn, score and sequence number
+void board_msg(Room *room, BoardMsg *msg) {
+    bb_to_cells(&room->game.board, msg->board);
+    msg->current_player = room->game.current_player;
+    msg->move_state = room->move_state;
+    msg->black_score = room->black_score;
+    msg->white_score = room->white_score;
+    msg->seq = room->seq;
+    room_clocks(room, &msg->clocks);
+}
+
+// Encode a full snapshot in the given format, return its length
+int encode_snapshot(Room *room, int proto, unsigned char *buffer) {
+    BoardMsg msg;
+    board_msg(room, &msg);
+    if (proto == PROTO_BINARY) return encode_board_binary(buffer, &msg);
+    // The text board is the payload of a text frame
+    int len = encode_board_text((char *)buffer + FRAME_HEADER_SIZE, &msg);
+    return encode_text(buffer, (char *)buffer + FRAME_HEADER_SIZE, len);
+}
+
+Shared *snapshot_shared(Room *room, int proto) {
+    unsigned char buffer[FRAME_HEADER_SIZE + TEXT_BOARD_MAX];
+    return shared_new(buffer, encode_snapshot(room, proto, buffer));
+}
+
+// Queue a full snapshot for one connection, in the format it negotiated
+void send_snapshot(Server *server, Room *room, Conn *conn) {
+    if (conn->spectator) {
+        Shared *msg = snapshot_shared(room, conn->proto);
+        queue_shared(server, conn, msg);
+        shared_put(msg);
+        return;
+    }
+    unsigned char buffer[FRAME_HEADER_SIZE + TEXT_BOARD_MAX];
+    queue_msg(server, conn, buffer, encode_snapshot(room, conn->proto, buffer));
+}
+
+// Queue one message for every spectator of the room, in the encoding each one negotiated.
+// Each encoding was serialized once, every queue only takes a reference.
+void fan_out(Server *server, Room *room, Shared *binary, Shared *text) {
+    for (Conn *conn = room->spectators; conn; conn = conn->spec_next)
+        queue_shared(server, conn, conn->proto == PROTO_BINARY ? binary : text);
+    shared_put(binary);
+    shared_put(text);
+}
+
+// Text message for the players and spectators of a room
+void send_room_text(Server *server, Room *room, const char *text) {
+    for (int i = 0; i < 2; i++)
+        if (room->players[i]) queue_text(server, room->players[i], text);
+    if (room->spectators) {
+        Shared *msg = shared_text(text);
+        msg->refs++;
+        fan_out(server, room, msg, msg);
+    }
+}
+
+// Send a full snapshot to both players and the spectators: on join and after a reset
+void send_board(Server *server, Room *room) {
+    static atomic_int count;
+    for (int i = 0; i < 2; i++)
+        if (room->players[i]) send_snapshot(server, room, room->players[i]);
+    if (room->spectators)
+        fan_out(server, room, snapshot_shared(room, PROTO_BINARY), snapshot_shared(room, PROTO_TEXT));
+    log_debug("Sending board to both players... n.%d", ++count);
+}
+
+// Broadcast the stone just placed: binary clients get a delta, text clients a full board
+void send_delta(Server *server, Room *room, int row, int col) {
+    Game *game = &room->game;
+    DeltaMsg delta = {++room->seq, row, col, bb_get(&game->board, row, col), game->current_player};
+    room_clocks(room, &delta.clocks);
+    unsigned char frame[DELTA_FRAME_SIZE];
+    int frame_len = encode_delta(frame, &delta);
+    for (int i = 0; i < 2; i++) {
+        Conn *conn = room->players[i];
+        if (!conn) continue;
+        if (conn->proto == PROTO_BINARY) queue_msg(server, conn, frame, frame_len);
+        else send_snapshot(server, room, conn);
+    }
+    if (room->spectators)
+        fan_out(server, room, shared_new(frame, frame_len), snapshot_shared(room, PROTO_TEXT));
+}
+
+// Close a connection after a last attempt to send what it has queued (such as END).
+// The Conn itself is freed after the current epoll batch and flush,
+// since later events of the same batch and the flush list may still point at it.
+void close_conn(Server *server, Conn *conn) {
+    if (conn->fd < 0) return;
+    if (conn->spectator) flush_shared(server, conn);
+    else ring_flush(&conn->out, conn->fd);
+    while (conn->ref_head != conn->ref_tail) shared_put(conn->refs[conn->ref_head++ % SPEC_QUEUE]);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+    if (conn->lobby.queued) lobby_remove(&server->lobby[conn->rules], &conn->lobby);
+    conn->next_dead = server->dead;
+    server->dead = conn;
+}
+
+// Take a room out of the list of voting rooms
+void unlink_vote(Server *server, Room *room) {
+    if (room->vote_prev) room->vote_prev->vote_next = room->vote_next;
+    else if (server->vote_head == room) server->vote_head = room->vote_next;
+    else return;
+    if (room->vote_next) room->vote_next->vote_prev = room->vote_prev;
+    else server->vote_tail = room->vote_prev;
+    room->vote_prev = room->vote_next = NULL;
+}
+
+// Stop watching: take a spectator out of its room's list, or out of the pending ones
+void unwatch(Server *server, Conn *conn) {
+    Conn **head = conn->room ? &conn->room->spectators : &server->watchers;
+    if (conn->spec_prev) conn->spec_prev->spec_next = conn->spec_next;
+    else *head = conn->spec_next;
+    if (conn->spec_next) conn->spec_next->spec_prev = conn->spec_prev;
+    if (conn->room) conn->room->spectator_count--;
+    conn->spec_prev = conn->spec_next = NULL;
+}
+
+// Make a connection watch a room read-only, or the next room created if room is NULL
+void watch_room(Server *server, Conn *conn, Room *room) {
+    Conn **head = room ? &room->spectators : &server->watchers;
+    conn->spectator = 1;
+    conn->room = room;
+    conn->spec_prev = NULL;
+    conn->spec_next = *head;
+    if (*head) (*head)->spec_prev = conn;
+    *head = conn;
+    if (!room) return;
+    room->spectator_count++;
+    send_snapshot(server, room, conn);
+}
+
+// Hand a message to a worker: lock-free multi-producer push, then wake the worker up.
+// The worker takes the whole list at once, so the push never races with a pop.
+void inbox_push(Server *target, Handoff *msg) {
+    Handoff *head = atomic_load_explicit(&target->inbox, memory_order_relaxed);
+    do msg->next = head;
+    while (!atomic_compare_exchange_weak_explicit(&target->inbox, &head, msg, memory_order_release,
+                                                  memory_order_relaxed));
+    uint64_t one = 1;
+    write(target->inbox_fd, &one, sizeof(one));
+}
+
+// Update the ratings of two named players from the games tallied in their room;
+// the table lives on worker 0
+void rate_match(Server *server, Room *room) {
+    Conn *black = room->players[0], *white = room->players[1];
+    int ratings[2] = {black->rating, white->rating};
+    elo_update(&ratings[0], &ratings[1], room->black_score, room->white_score, room->draws);
+    for (int i = 0; i < 2; i++) {
+        Conn *conn = room->players[i];
+        if (!conn->name[0]) continue;
+        log_text(LOG_INFO, conn->name, "Rating of %s: %d -> %d", conn->rating, ratings[i]);
+        Handoff *msg = calloc(1, sizeof(Handoff));
+        msg->type = HANDOFF_RATING;
+        strcpy(msg->name, conn->name);
+        msg->rating = ratings[i];
+        inbox_push(&server->cluster->workers[0], msg);
+    }
+}
+
+// Send END to both players and the spectators and tear the room down
+void close_room(Server *server, Room *room) {
+    char buffer[64];
+    if (room->ai_colour == EMPTY && !room->recovered) rate_match(server, room);
+    journal_room(server, room, JR_END, 0, EMPTY);
+    sprintf(buffer, "END %d %d", room->black_score, room->white_score);
+    send_room_text(server, room, buffer);
+    for (int i = 0; i < 2; i++) {
+        Conn *conn = room->players[i];
+        if (!conn) continue;
+        log_debug("Sending END to player %d", i + 1);
+        conn->room = NULL;
+        close_conn(server, conn);
+    }
+    while (room->spectators) {
+        Conn *conn = room->spectators;
+        unwatch(server, conn);
+        conn->room = NULL;
+        close_conn(server, conn);
+    }
+    if (room->prev) room->prev->next = room->next;
+    else server->rooms = room->next;
+    if (room->next) room->next->prev = room->prev;
+    server->room_count--;
+    unlink_vote(server, room);
+    wheel_cancel(&server->wheel, &room->flag);
+    // An engine thread still holds the room: free it when the result comes back
+    if (room->ai_busy) room->closed = 1;
+    else room_free(room);
+}
+
+// Give a room the vote timeout from now and append it to the list of voting rooms
+void link_vote(Server *server, Room *room) {
+    room->vote_deadline = now_ms() + server->vote_timeout_ms;
+    room->vote_next = NULL;
+    room->vote_prev = server->vote_tail;
+    if (server->vote_tail) server->vote_tail->vote_next = room;
+    else server->vote_head = room;
+    server->vote_tail = room;
+}
+
+// Game ended: send the scores, the winner and the time left to vote, then let the event
+// loop collect the votes in any order until the deadline
+void start_voting(Server *server, Room *room, int winner) {
+    char buffer[64];
+    sprintf(buffer, "VOTE %d %d %d %d", room->black_score, room->white_score, winner, server->vote_timeout_ms / 1000);
+    send_room_text(server, room, buffer);
+    log_text(LOG_DEBUG, buffer, "Sent votes: %s to both players");
+    room->state = ROOM_VOTING;
+    room->winner = winner;
+    room->votes[0] = room->votes[1] = 0;
+    room->vote_start_ns = metrics_clock_ns();
+    // The engine always wants a rematch
+    if (room->ai_colour) room->votes[room->ai_colour - 1] = 'y';
+    journal_room(server, room, JR_RESULT, 0, winner);
+    link_vote(server, room);
+}
+
+// The player to move ran out of time: the game ends as a win for the opponent
+void flag_fall(Server *server, Room *room) {
+    int loser = room->game.current_player;
+    wheel_cancel(&server->wheel, &room->flag);
+    room->clocks[loser - 1].left_ms = room->clocks[loser - 1].periods = 0;
+    room->game.current_player = EMPTY;
+    log_info("Room %d: player %d ran out of time", room->id, loser);
+    send_board(server, room);
+    start_voting(server, room, loser == BLACK ? WHITE : BLACK);
+}
+
+// Queue a search for the engine's move; the I/O thread never waits for it
+void submit_ai(Server *server, Room *room) {
+    AiPool *ai = &server->cluster->ai;
+    AiJob *job = calloc(1, sizeof(AiJob));
+    job->owner = server;
+    job->room = room;
+    job->seq = room->seq;
+    job->board = room->game.board;
+    job->colour = room->ai_colour;
+    room->ai_busy = 1;
+    pthread_mutex_lock(&ai->lock);
+    if (ai->todo_tail) ai->todo_tail->next = job;
+    else ai->todo = job;
+    ai->todo_tail = job;
+    pthread_cond_signal(&ai->cond);
+    pthread_mutex_unlock(&ai->lock);
+}
+
+// Engine thread: run one search at a time, sharing the cores with the other running searches
+void *ai_thread(void *arg) {
+    AiPool *ai = arg;
+    while (1) {
+        pthread_mutex_lock(&ai->lock);
+        while (!ai->todo) pthread_cond_wait(&ai->cond, &ai->lock);
+        AiJob *job = ai->todo;
+        ai->todo = job->next;
+        if (!ai->todo) ai->todo_tail = NULL;
+        int threads = ai->cores / ++ai->searching;
+        pthread_mutex_unlock(&ai->lock);
+
+        engine_search(&job->board, job->colour, AI_BUDGET_MS, threads, &job->result);
+
+        pthread_mutex_lock(&ai->lock);
+        ai->searching--;
+        pthread_mutex_unlock(&ai->lock);
+        Handoff *msg = calloc(1, sizeof(Handoff));
+        msg->type = HANDOFF_AI;
+        msg->job = job;
+        inbox_push(job->owner, msg);
+    }
+    return NULL;
+}
+
+// Record one vote; once both are in, replay if both players agree, otherwise close the room
+void handle_vote(Server *server, Room *room, int player, char vote) {
+    room->votes[player - 1] = vote;
+    if (!room->votes[0] || !room->votes[1]) return;
+    unlink_vote(server, room);
+    hist_record(&server->metrics, H_VOTE, metrics_clock_ns() - room->vote_start_ns, 1);
+    log_debug("Received votes: %c %c from both players", room->votes[0], room->votes[1]);
+    int result = (room->votes[0] == 'y' && room->votes[1] == 'y');
+    log_debug("Voting result: %d", result);
+    // Update the score either way, the final one feeds the ratings
+    room->black_score += room->winner == BLACK;
+    room->white_score += room->winner == WHITE;
+    room->draws += room->winner == EMPTY;
+    if (!result) {
+        close_room(server, room);
+        return;
+    }
+    // If both agree to replay, reset board, continue game
+    game_reset(&room->game);
+    reset_clocks(room);
+    room->state = ROOM_PLAYING;
+    send_board(server, room);
+    start_clock(server, room);
+}
+
+// Place a stone for the player to move, then hand the turn over or end the game.
+// Return the outcome from game_play, or MOVE_LATE; a refused move changes nothing.
+int play_move(Server *server, Room *room, int row, int col) {
+    int colour = room->game.current_player;
+    if (clock_expired(room)) {
+        flag_fall(server, room);
+        return MOVE_LATE;
+    }
+    uint64_t start = metrics_clock_ns();
+    int result = game_play(&room->game, row, col);
+    if (result == GAME_ILLEGAL || result == GAME_FORBIDDEN) {
+        metric_add(&server->metrics, M_INVALID, 1);
+        return result;
+    }
+    hist_record(&server->metrics, H_CHECK_WIN, metrics_clock_ns() - start, 1);
+    stop_clock(server, room, colour);
+    metric_add(&server->metrics, M_MOVES, 1);
+    server->batch_moves++;
+    // Five in a row, or a full board without one: nobody moves next, which the update
+    // sends as next player EMPTY
+    if (result != GAME_ONGOING) {
+        send_delta(server, room, row, col);
+        journal_room(server, room, JR_MOVE, row * BOARD_SIZE + col, colour);
+        start_voting(server, room, result == GAME_WIN ? colour : EMPTY);
+        return result;
+    }
+    start_clock(server, room);
+    send_delta(server, room, row, col);
+    journal_room(server, room, JR_MOVE, row * BOARD_SIZE + col, colour);
+    if (room->game.current_player == room->ai_colour) submit_ai(server, room);
     return result;
 }
 
-int main() {
-    // Create socket, bind, and listen
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in serv_addr = {AF_INET, htons(PORT), INADDR_ANY};
-    bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
-    listen(sockfd, 2);
-    printf("Waiting for players...\n");
-
-    GameState game;
-    socklen_t clilen = sizeof(serv_addr);
-    // Accept connection from the first player and send identification
-    game.socket1 = accept(sockfd, (struct sockaddr *)&serv_addr, &clilen);
-    write(game.socket1, "PLAYER 1", 8);
-    printf("Player 1 connected\n");
-    // Accept connection from the second player and send identification
-    game.socket2 = accept(sockfd, (struct sockaddr *)&serv_addr, &clilen);
-    write(game.socket2, "PLAYER 2", 8);
-    printf("Player 2 connected\n");
-
-    // Initialize board and send initial state
-    init_board(&game);
-    send_board(&game);
+// Tell a player its move was not played. A move sent with a request id gets "REJECT id reason",
+// so the client can take back the stone it already shows; without one only Renju's verdict is
+// reported, as "FORBIDDEN row col".
+void reject_move(Server *server, Conn *conn, unsigned id, int reason, int row, int col) {
+    char buffer[48];
+    if (id) sprintf(buffer, "REJECT %u %s", id, reason == GAME_FORBIDDEN ? "FORBIDDEN" : reason == MOVE_LATE ? "TIME"
+                                               : reason == MOVE_TURN ? "TURN" : "ILLEGAL");
+    else if (reason == GAME_FORBIDDEN) sprintf(buffer, "FORBIDDEN %d %d", row, col);
+    else return;
+    queue_text(server, conn, buffer);
+}
+
+// Random, non-zero secret a player quotes to take their seat back after a restart
+unsigned new_token(void) {
+    unsigned token = 0;
+    while (!token)
+        if (getrandom(&token, sizeof(token), 0) != sizeof(token)) token = (unsigned)now_ms() * 2654435761u;
+    return token;
+}
+
+// Journal a human seat of a new room: its token and its player's rating, so both survive a restart
+void journal_seat(Server *server, Room *room, int player) {
+    Journal *journal = server->cluster->journal;
+    if (!journal) return;
+    journal_add(journal, &server->journal_batch, JR_SEAT, room->id, room->tokens[player - 1], 0, player);
+    journal_add(journal, &server->journal_batch, JR_RATING, room->id, room->ratings[player - 1], 0, player);
+}
+
+// Tell a seated player their colour, rating, room and the token that gives the seat back
+void send_player(Server *server, Room *room, Conn *conn) {
+    char buffer[64];
+    sprintf(buffer, "PLAYER %d %d %d %u", conn->player, room->ratings[conn->player - 1], room->id,
+            room->tokens[conn->player - 1]);
+    queue_text(server, conn, buffer);
+}
+
+// Seat two connections in a new room and start the game; without a white player,
+// the server's engine plays white. Pending spectators watch the new room.
+void create_room(Server *server, Conn *black, Conn *white) {
+    Room *room = room_new(black->rules);
+    room->time = server->cluster->time;
+    reset_clocks(room);
+    // Ids tell which worker owns the room
+    room->id = server->next_room_id++ * server->cluster->count + server->index + 1;
+    room->next = server->rooms;
+    if (server->rooms) server->rooms->prev = room;
+    server->rooms = room;
+    room->players[0] = black;
+    room->players[1] = white;
+    room->ai_colour = white ? EMPTY : WHITE;
+    server->room_count++;
+    log_info("Room %d created, %d rooms running on worker %d", room->id, server->room_count, server->index);
+    room->state = ROOM_PLAYING;
+    journal_room(server, room, JR_START, room->game.rules, room->ai_colour);
+    for (int i = 0; i < 2; i++) {
+        Conn *conn = room->players[i];
+        if (!conn) continue;
+        conn->room = room;
+        conn->player = i + 1;
+        room->ratings[i] = conn->rating;
+        room->tokens[i] = new_token();
+        journal_seat(server, room, i + 1);
+        send_player(server, room, conn);
+    }
+    send_board(server, room);
+    start_clock(server, room);
+    while (server->watchers) {
+        Conn *conn = server->watchers;
+        unwatch(server, conn);
+        watch_room(server, conn, room);
+    }
+}
+
+Room *find_room(Server *server, int id) {
+    for (Room *room = server->rooms; room; room = room->next)
+        if (room->id == id) return room;
+    return NULL;
+}
+
+// Seat a player coming back to a room recovered from the journal, in the seat it asked for
+// (conn->player) and only with that seat's token (conn->token); the game goes on once every
+// human seat is taken again
+void resume_room(Server *server, Conn *conn, int id) {
+    Room *room = find_room(server, id);
+    int player = conn->player;
+    if (!room || room->state != ROOM_RESUMING || (player != BLACK && player != WHITE)
+        || player == room->ai_colour || room->players[player - 1]
+        || !room->tokens[player - 1] || conn->token != room->tokens[player - 1]) {
+        conn->player = EMPTY;
+        queue_text(server, conn, "END 0 0");
+        close_conn(server, conn);
+        return;
+    }
+    room->players[player - 1] = conn;
+    conn->room = room;
+    send_player(server, room, conn);
+    send_snapshot(server, room, conn);
+    log_info("Player %d is back in room %d", player, room->id);
+    for (int i = 0; i < 2; i++)
+        if (!room->players[i] && room->ai_colour != i + 1) return;
+    unlink_vote(server, room);
+    room->state = ROOM_PLAYING;
+    // The clocks are not journaled: the game goes on with full time
+    reset_clocks(room);
+    start_clock(server, room);
+    if (room->game.current_player == room->ai_colour) submit_ai(server, room);
+}
+
+// Send a connection (and, for a new room, its opponent) to another worker. They leave this
+// worker once the current batch is flushed; until then their events are ignored.
+void handoff(Server *server, Server *target, int type, Conn *conn, Conn *partner, int room_id) {
+    Handoff *msg = calloc(1, sizeof(Handoff));
+    msg->type = type;
+    msg->conn = conn;
+    msg->partner = partner;
+    msg->room_id = room_id;
+    msg->target = target;
+    conn->moving = 1;
+    if (partner) partner->moving = 1;
+    msg->next = server->outbox;
+    server->outbox = msg;
+}
+
+// Take the connections out of this worker's epoll set and push them to their new workers
+void send_handoffs(Server *server) {
+    while (server->outbox) {
+        Handoff *msg = server->outbox;
+        server->outbox = msg->next;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, msg->conn->fd, NULL);
+        if (msg->partner) epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, msg->partner->fd, NULL);
+        inbox_push(msg->target, msg);
+    }
+}
+
+// Lobby, run by worker 0: pair the player with the closest-rated one waiting within their
+// windows among those who asked for the same rules, in a room on the worker that accepted
+// the player who waited; otherwise wait
+void lobby_play(Server *server, Conn *conn) {
+    uint64_t now = now_ms();
+    Lobby *lobby = &server->lobby[conn->rules];
+    LobbyEntry *match = lobby_match(lobby, &conn->lobby, now);
+    if (!match) {
+        lobby_add(lobby, &conn->lobby, now);
+        return;
+    }
+    if (conn->lobby.queued) lobby_remove(lobby, &conn->lobby);
+    lobby_remove(lobby, match);
+    Conn *black = (Conn *)((char *)match - offsetof(Conn, lobby));
+    Server *target = &server->cluster->workers[black->home];
+    log_info("Matched ratings %d and %d", black->rating, conn->rating);
+    if (target == server) create_room(server, black, conn);
+    else handoff(server, target, HANDOFF_ROOM, black, conn, 0);
+}
+
+// A player asking to play enters the lobby with its stored rating
+void join_lobby(Server *server, Conn *conn) {
+    if (conn->lobby.queued) return;
+    conn->rating = conn->name[0] ? rating_get(server->ratings, conn->name) : RATING_START;
+    conn->lobby.rating = conn->rating;
+    conn->lobby.joined_ms = now_ms();
+    lobby_play(server, conn);
+}
+
+// Match the waiting players whose rating window widened; return the ms until the next
+// recheck, -1 if there is none (or this worker has no lobby)
+int rematch(Server *server) {
+    if (!server->lobby) return -1;
+    LobbyEntry *e;
+    uint64_t now = now_ms();
+    int next = -1;
+    for (int rules = 0; rules < RULES_COUNT; rules++) {
+        Lobby *lobby = &server->lobby[rules];
+        while ((e = lobby_due(lobby, now))) lobby_play(server, (Conn *)((char *)e - offsetof(Conn, lobby)));
+        int check = lobby_next_check(lobby, now);
+        if (check >= 0 && (next < 0 || check < next)) next = check;
+    }
+    return next;
+}
+
+// A player leaving ends its room, a spectator only leaves the room it watches
+void drop_conn(Server *server, Conn *conn) {
+    if (conn->spectator) unwatch(server, conn);
+    else if (conn->room) {
+        close_room(server, conn->room);
+        return;
+    }
+    close_conn(server, conn);
+}
+
+// Sum the metrics of every worker. The other workers keep running: each counter is exact,
+// the set of them is only as consistent as a moving target allows.
+void collect_metrics(Server *server, MetricsSnapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+    for (int w = 0; w < server->cluster->count; w++) metrics_merge(snap, &server->cluster->workers[w].metrics);
+}
+
+// Answer STATS with the metrics of the whole server, one line per counter or histogram
+void send_stats(Server *server, Conn *conn) {
+    MetricsSnapshot *snap = malloc(sizeof(MetricsSnapshot));
+    unsigned char frame[FRAME_HEADER_SIZE + STATS_MAX];
+    char text[STATS_MAX];
+    collect_metrics(server, snap);
+    int len = encode_text(frame, text, metrics_format(snap, NULL, 0, text, sizeof(text)));
+    free(snap);
+    if (!conn->spectator) {
+        queue_msg(server, conn, frame, len);
+        return;
+    }
+    Shared *msg = shared_new(frame, len);
+    queue_shared(server, conn, msg);
+    shared_put(msg);
+}
+
+// Worker 0 with -s: print the metrics and their rates since the previous dump when it is due;
+// return the ms until the next dump, -1 if there are none
+int dump_stats(Server *server) {
+    if (!server->dumped) return -1;
+    uint64_t now = metrics_clock_ns(), due = server->dump_ns + server->cluster->stats_ms * 1000000ULL;
+    if (now < due) return (due - now + 999999) / 1000000;
+    MetricsSnapshot *snap = malloc(sizeof(MetricsSnapshot));
+    char text[STATS_MAX];
+    collect_metrics(server, snap);
+    metrics_format(snap, server->dumped, (now - server->dump_ns) / 1e9, text, sizeof(text));
+    char *save;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+        log_text(LOG_INFO, line, "%s");
+    free(server->dumped);
+    server->dumped = snap;
+    server->dump_ns = now;
+    return server->cluster->stats_ms;
+}
+
+// Handle one command line received from a player
+void handle_command(Server *server, Conn *conn, char *command) {
+    Room *room = conn->room;
+    int row, col, version;
+    // Protocol negotiation, the text encoding stays the fallback for unknown versions
+    if (sscanf(command, "PROTO %d", &version) == 1) {
+        conn->proto = version == PROTO_BINARY ? PROTO_BINARY : PROTO_TEXT;
+        // Seated before the request arrived: resend the board in the new format
+        if (room && conn->proto == PROTO_BINARY) send_snapshot(server, room, conn);
+        return;
+    }
+    // Anyone may ask for the metrics, whatever the connection is doing
+    if (strncmp(command, "STATS", 5) == 0) {
+        send_stats(server, conn);
+        return;
+    }
+    // In the lobby: play the next player to join, play the server's engine, watch,
+    // or take a seat back after a restart
+    if (!room && !conn->spectator) {
+        int id, owner;
+        char rules[16];
+        if (sscanf(command, "RULES %15s", rules) == 1) {
+            // Picked before PLAY or SOLO; a waiting player stays in the lobby of its ruleset
+            if (!conn->lobby.queued) conn->rules = strcasecmp(rules, "RENJU") == 0 ? RULES_RENJU : RULES_FREESTYLE;
+        } else if (strncmp(command, "PLAY", 4) == 0) {
+            if (sscanf(command, "PLAY %15s", conn->name) != 1) conn->name[0] = '\0';
+            if (server->index == 0) join_lobby(server, conn);
+            else handoff(server, &server->cluster->workers[0], HANDOFF_LOBBY, conn, NULL, 0);
+        } else if (strncmp(command, "SOLO", 4) == 0) {
+            if (conn->lobby.queued) lobby_remove(&server->lobby[conn->rules], &conn->lobby);
+            create_room(server, conn, NULL);
+        } else if (strncmp(command, "WATCH", 5) == 0) {
+            if (conn->lobby.queued) lobby_remove(&server->lobby[conn->rules], &conn->lobby);
+            // Without an id: this worker's newest room, or the next one it creates.
+            // A room of another worker is watched from there.
+            if (sscanf(command, "WATCH %d", &id) != 1) watch_room(server, conn, server->rooms);
+            else if (id > 0 && (owner = (id - 1) % server->cluster->count) != server->index)
+                handoff(server, &server->cluster->workers[owner], HANDOFF_WATCH, conn, NULL, id);
+            else if ((room = find_room(server, id))) watch_room(server, conn, room);
+            else {
+                // The room does not exist (any more)
+                queue_text(server, conn, "END 0 0");
+                close_conn(server, conn);
+            }
+        } else if (sscanf(command, "RESUME %d %d %u", &id, &conn->player, &conn->token) == 3) {
+            if (conn->lobby.queued) lobby_remove(&server->lobby[conn->rules], &conn->lobby);
+            if (id > 0 && (owner = (id - 1) % server->cluster->count) != server->index)
+                handoff(server, &server->cluster->workers[owner], HANDOFF_RESUME, conn, NULL, id);
+            else resume_room(server, conn, id);
+        }
+        return;
+    }
+    if (!room) return;
+    // The client missed a delta: resend the whole board
+    if (strncmp(command, "SYNC", 4) == 0) {
+        send_snapshot(server, room, conn);
+        return;
+    }
+    // Spectators are read-only
+    if (conn->spectator) return;
+    // Votes arrive as commands like any other, in whatever order the players send them
+    char vote;
+    if (room->state == ROOM_VOTING && sscanf(command, "VOTE %c", &vote) == 1) {
+        if (!room->votes[conn->player - 1]) handle_vote(server, room, conn->player, vote);
+        return;
+    }
+    // "MOVE row col [id]": clients that draw the stone before the update send a request id
+    unsigned id = 0;
+    if (sscanf(command, "MOVE %d %d %u", &row, &col, &id) < 2) return;
+    // Only the player whose turn it is may move
+    if (room->state != ROOM_PLAYING || conn->player != room->game.current_player || room->move_state != 0) {
+        metric_add(&server->metrics, M_INVALID, 1);
+        reject_move(server, conn, id, MOVE_TURN, row, col);
+        return;
+    }
+    log_text(LOG_DEBUG, command, "Handling %s");
+    int result = play_move(server, room, row, col);
+    if (result < 0) reject_move(server, conn, id, result, row, col);
+}
+
+// Handle every complete frame buffered on a connection; commands are text frames,
+// anything that is not a frame ends the connection
+void handle_input(Server *server, Conn *conn) {
+    char frame[CONN_BUF_SIZE + 1];
+    int len = 0;
+    while (conn->fd >= 0 && !conn->moving && (len = ring_frame_length(&conn->in)) > 0) {
+        ring_take(&conn->in, frame, len);
+        frame[len] = '\0';
+        if ((unsigned char)frame[2] == MSG_TEXT) handle_command(server, conn, frame + FRAME_HEADER_SIZE);
+    }
+    if (len < 0) {
+        log_warn("Protocol error, closing connection");
+        drop_conn(server, conn);
+    }
+}
+
+// Accept every pending connection; it stays in the lobby until it sends PLAY, SOLO or WATCH
+void accept_conns(Server *server) {
+    while (1) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) log_text(LOG_ERROR, strerror(errno), "accept: %s");
+            return;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        // Updates are small and latency-bound: send them without waiting for Nagle
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        metric_add(&server->metrics, M_ACCEPTS, 1);
+        Conn *conn = calloc(1, sizeof(Conn));
+        conn->fd = fd;
+        conn->home = server->index;
+        ring_init(&conn->in, CONN_BUF_SIZE);
+        ring_init(&conn->out, CONN_OUT_SIZE);
+        struct epoll_event ev = {EPOLLIN, {.ptr = conn}};
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        log_info("Player connected");
+    }
+}
+
+// Register a connection handed over by another worker with this worker's epoll set
+void adopt(Server *server, Conn *conn) {
+    conn->moving = 0;
+    conn->want_write = 0;
+    struct epoll_event ev = {EPOLLIN, {.ptr = conn}};
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+    if (ring_used(&conn->out)) mark_flush(server, conn);
+}
+
+// The engine found no move, or the rules refused it (Renju): play the first candidate of the move
+// generator the rules accept, or end the game as a draw if there is none
+void ai_fallback(Server *server, Room *room) {
+    int cells[BOARD_SIZE * BOARD_SIZE];
+    int n = engine_candidates(&room->game.board, room->ai_colour, cells, BOARD_SIZE * BOARD_SIZE);
+    for (int i = 0; i < n; i++) {
+        int result = play_move(server, room, cells[i] / BOARD_SIZE, cells[i] % BOARD_SIZE);
+        if (result != GAME_ILLEGAL && result != GAME_FORBIDDEN) return;
+    }
+    log_info("Room %d: no legal move for the engine, the game is a draw", room->id);
+    wheel_cancel(&server->wheel, &room->flag);
+    room->game.current_player = EMPTY;
+    send_board(server, room);
+    start_voting(server, room, EMPTY);
+}
+
+// Apply the engine's move, unless the room moved on (or closed) while it was searching
+void ai_result(Server *server, AiJob *job) {
+    Room *room = job->room;
+    room->ai_busy = 0;
+    if (room->closed) room_free(room);
+    else if (room->seq == job->seq && room->state == ROOM_PLAYING && room->game.current_player == job->colour) {
+        int result = play_move(server, room, job->result.row, job->result.col);
+        if (result == GAME_ILLEGAL || result == GAME_FORBIDDEN) ai_fallback(server, room);
+    }
+    free(job);
+}
+
+// Handle the messages other threads pushed since the last wakeup, in the order they were sent.
+// Commands a moved connection had already sent are handled once it is settled here.
+void drain_inbox(Server *server) {
+    uint64_t count;
+    read(server->inbox_fd, &count, sizeof(count));
+    Handoff *msg = atomic_exchange_explicit(&server->inbox, NULL, memory_order_acquire), *fifo = NULL;
+    while (msg) {
+        Handoff *next = msg->next;
+        msg->next = fifo;
+        fifo = msg;
+        msg = next;
+    }
+    while ((msg = fifo)) {
+        fifo = msg->next;
+        Conn *conn = msg->conn;
+        if (msg->type == HANDOFF_AI) ai_result(server, msg->job);
+        else if (msg->type == HANDOFF_RATING) rating_set(server->ratings, msg->name, msg->rating);
+        else adopt(server, conn);
+        if (msg->type == HANDOFF_LOBBY) join_lobby(server, conn);
+        else if (msg->type == HANDOFF_ROOM) {
+            adopt(server, msg->partner);
+            create_room(server, conn, msg->partner);
+            handle_input(server, msg->partner);
+        } else if (msg->type == HANDOFF_WATCH) {
+            Room *room = find_room(server, msg->room_id);
+            if (room) watch_room(server, conn, room);
+            else {
+                queue_text(server, conn, "END 0 0");
+                close_conn(server, conn);
+            }
+        } else if (msg->type == HANDOFF_RESUME) resume_room(server, conn, msg->room_id);
+        if (conn) handle_input(server, conn);
+        free(msg);
+    }
+}
 
+// Count the missing votes of every room past its deadline as "n", and close the recovered
+// rooms whose players did not come back in time;
+// return the ms left until the next deadline, -1 if no room is voting
+int expire_votes(Server *server) {
+    uint64_t now = now_ms();
+    while (server->vote_head && server->vote_head->vote_deadline <= now) {
+        Room *room = server->vote_head;
+        if (room->state == ROOM_RESUMING) {
+            log_info("Room %d abandoned", room->id);
+            close_room(server, room);
+            continue;
+        }
+        log_info("Vote timed out");
+        for (int i = 0; i < 2; i++)
+            if (!room->votes[i]) room->votes[i] = 'n';
+        handle_vote(server, room, BLACK, room->votes[0]);
+    }
+    return server->vote_head ? (int)(server->vote_head->vote_deadline - now) : -1;
+}
+
+// End the games of the players whose time ran out;
+// return the ms until the wheel's next timer, -1 if no clock is running
+int expire_clocks(Server *server) {
+    uint64_t now = now_ms();
+    Timer *timer = wheel_advance(&server->wheel, now);
+    while (timer) {
+        Timer *next = timer->next;
+        flag_fall(server, (Room *)((char *)timer - offsetof(Room, flag)));
+        timer = next;
+    }
+    return wheel_next(&server->wheel, now);
+}
+
+// Read what is available on a connection; a disconnect ends the player's room
+void read_conn(Server *server, Conn *conn) {
+    int n = ring_read(&conn->in, conn->fd);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        log_info("Player disconnected");
+        drop_conn(server, conn);
+        return;
+    }
+    metric_add(&server->metrics, M_BYTES_IN, n);
+    handle_input(server, conn);
+}
+
+// Event loop of one worker
+void *worker_loop(void *arg) {
+    Server *server = arg;
+    struct epoll_event events[MAX_EVENTS];
     while (1) {
-        char buffer[256];
-        // Determine which player's message to read based on current turn
-        int sock = game.current_player == BLACK ? game.socket1 : game.socket2;
-        int n = read(sock, buffer, sizeof(buffer));
-        if (n <= 0) break;
-        printf("Received:%s\n", buffer);
-
-        char *command = strtok(buffer, "\n");
-        int row, col, fr, fc;
-        if (sscanf(command, "MOVE %d %d", &row, &col) == 2 && game.move_state == 0) {
-            printf("Handling %s\n", command);
-            if (row >= 0 && row < BOARD_SIZE && col >= 0 && col < BOARD_SIZE && game.board[row][col] == EMPTY) {
-                game.board[row][col] = game.current_player;
-                game.stone_count[game.current_player - 1]++;
-                // Check for five in a row
-                if (check_win(&game, row, col)) {
-                    send_board(&game); 
-                    if (handle_voting(&game, game.current_player)) {
-                        // If both agree to replay, update score, reset board, continue game
-                        game.black_score += game.current_player == BLACK;
-                        game.white_score += game.current_player == WHITE;
-                        init_board(&game);
-                        send_board(&game);
-                        continue;
-                    }
-                    // Otherwise, send END message and exit
-                    sprintf(command, "END %d %d", game.black_score, game.white_score);
-                    write(game.socket1, command, strlen(command));
-                    printf("Sending END to player 1\n");
-                    write(game.socket2, command, strlen(command));
-                    printf("Sending END to player 2\n");
-                    break;
-                }
-                // Switch turn
-                game.current_player = game.current_player == BLACK ? WHITE : BLACK;
-                send_board(&game);
+        int timeout = expire_votes(server), check = rematch(server), dump = dump_stats(server);
+        int clocks = expire_clocks(server);
+        if (check >= 0 && (timeout < 0 || check < timeout)) timeout = check;
+        if (dump >= 0 && (timeout < 0 || dump < timeout)) timeout = dump;
+        if (clocks >= 0 && (timeout < 0 || clocks < timeout)) timeout = clocks;
+        // Commit the last batch's journal records and wait for their sync, so that no reply
+        // acknowledges a move a crash could lose; then send what the batch queued, move the
+        // handed-off connections, and free the connections it closed
+        if (server->journal_batch) {
+            journal_commit(server->cluster->journal, server->journal_batch, server->journal_fd);
+            server->journal_batch = NULL;
+        }
+        flush_conns(server);
+        if (server->batch_moves) {
+            hist_record(&server->metrics, H_MOVE, metrics_clock_ns() - server->batch_ns, server->batch_moves);
+            server->batch_moves = 0;
+        }
+        send_handoffs(server);
+        while (server->dead) {
+            Conn *conn = server->dead;
+            server->dead = conn->next_dead;
+            ring_free(&conn->in);
+            ring_free(&conn->out);
+            free(conn);
+        }
+        int n = epoll_wait(server->epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_text(LOG_ERROR, strerror(errno), "epoll_wait: %s");
+            break;
+        }
+        server->batch_ns = metrics_clock_ns();
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &server->listen_fd) accept_conns(server);
+            else if (ptr == &server->inbox_fd) drain_inbox(server);
+            else {
+                Conn *conn = ptr;
+                if (conn->fd < 0 || conn->moving) continue;
+                if (events[i].events & EPOLLOUT) flush_conn(server, conn);
+                if (conn->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) read_conn(server, conn);
             }
         }
     }
-    // Close sockets and exit program
-    close(game.socket1);
-    close(game.socket2);
-    close(sockfd);
+    return NULL;
+}
+
+// Rooms rebuilt from the journal, indexed by id
+typedef struct {
+    Room **rooms;
+    unsigned size, max_id;
+} Replay;
+
+// Apply one journal record to the room it belongs to
+void replay_record(const JournalRecord *r, uint64_t epoch_ms, void *arg) {
+    Replay *replay = arg;
+    if (r->room >= replay->size) {
+        unsigned size = replay->size ? replay->size : 1024;
+        while (size <= r->room) size *= 2;
+        replay->rooms = realloc(replay->rooms, size * sizeof(Room *));
+        memset(replay->rooms + replay->size, 0, (size - replay->size) * sizeof(Room *));
+        replay->size = size;
+    }
+    if (r->room > replay->max_id) replay->max_id = r->room;
+    Room *room = replay->rooms[r->room];
+    if (r->type == JR_START) {
+        room = replay->rooms[r->room] = room_new(r->cell);
+        room->id = r->room;
+        room->ai_colour = r->colour;
+        return;
+    }
+    // Started in a segment that was lost
+    if (!room) return;
+    if (r->type == JR_MOVE) {
+        // The first move after a result starts the replayed game
+        if (room->state == ROOM_VOTING) {
+            game_reset(&room->game);
+            room->state = ROOM_PLAYING;
+        }
+        // Journaled moves were accepted when they were played: replay them as they come
+        room->game.current_player = r->colour;
+        game_play(&room->game, r->cell / BOARD_SIZE, r->cell % BOARD_SIZE);
+        room->seq = r->seq;
+    } else if (r->type == JR_RESULT) {
+        room->black_score += r->colour == BLACK;
+        room->white_score += r->colour == WHITE;
+        room->draws += r->colour == EMPTY;
+        room->game.current_player = EMPTY;
+        room->state = ROOM_VOTING;
+    } else if (r->type == JR_SEAT && (r->colour == BLACK || r->colour == WHITE)) {
+        room->tokens[r->colour - 1] = r->seq;
+    } else if (r->type == JR_RATING && (r->colour == BLACK || r->colour == WHITE)) {
+        room->ratings[r->colour - 1] = r->seq;
+    } else if (r->type == JR_END) {
+        room_free(room);
+        replay->rooms[r->room] = NULL;
+    }
+}
+
+// Rebuild the rooms still open when the server stopped on the workers that own their ids;
+// they wait for their players to send RESUME. New room ids start after every journaled one.
+void recover(Cluster *cluster, const char *dir) {
+    Replay replay = {NULL, 0, 0};
+    long records = journal_scan(dir, replay_record, &replay);
+    int live = 0;
+    if (records < 0) return;
+    for (unsigned id = 1; id <= replay.max_id; id++) {
+        Room *room = replay.rooms[id];
+        if (!room) continue;
+        Server *server = &cluster->workers[(id - 1) % cluster->count];
+        // A game waiting for its votes is over: the players come back to a new one
+        if (room->state == ROOM_VOTING) game_reset(&room->game);
+        room->state = ROOM_RESUMING;
+        room->recovered = 1;
+        room->time = cluster->time;
+        room->next = server->rooms;
+        if (server->rooms) server->rooms->prev = room;
+        server->rooms = room;
+        server->room_count++;
+        link_vote(server, room);
+        live++;
+    }
+    for (int w = 0; w < cluster->count; w++) cluster->workers[w].next_room_id = replay.max_id / cluster->count + 1;
+    free(replay.rooms);
+    log_info("Replayed %ld journal records, %d rooms waiting for their players", records, live);
+}
+
+// Parse a time control given in seconds as main[+increment][/byoyomi[xperiods]], e.g. "300+5"
+// or "600/30x3"; return -1 if it is malformed
+int parse_time_control(const char *spec, TimeControl *time) {
+    int main_s, increment = 0, byoyomi = 0, periods = 1, n;
+    if (sscanf(spec, "%d%n", &main_s, &n) != 1 || main_s <= 0) return -1;
+    spec += n;
+    if (*spec == '+' && (sscanf(spec + 1, "%d%n", &increment, &n) != 1 || increment < 0)) return -1;
+    if (*spec == '+') spec += n + 1;
+    if (*spec == '/' && (sscanf(spec + 1, "%d%n", &byoyomi, &n) != 1 || byoyomi <= 0)) return -1;
+    if (*spec == '/') spec += n + 1;
+    if (byoyomi && *spec == 'x' && (sscanf(spec + 1, "%d%n", &periods, &n) != 1 || periods <= 0 || periods > 255))
+        return -1;
+    if (byoyomi && *spec == 'x') spec += n + 1;
+    if (*spec) return -1;
+    *time = (TimeControl){main_s * 1000, increment * 1000, byoyomi * 1000, periods};
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static Cluster cluster;
+    int opt, vote_timeout_ms = VOTE_TIMEOUT * 1000;
+    const char *journal_dir = NULL;
+    log_init();
+    cluster.count = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "c:j:s:v:w:")) != -1) {
+        if (opt == 'c' && parse_time_control(optarg, &cluster.time) == 0) continue;
+        if (opt == 'j') journal_dir = optarg;
+        else if (opt == 's' && atoi(optarg) > 0) cluster.stats_ms = atoi(optarg) * 1000;
+        else if (opt == 'v' && atoi(optarg) > 0) vote_timeout_ms = atoi(optarg) * 1000;
+        else if (opt == 'w' && atoi(optarg) > 0) cluster.count = atoi(optarg);
+        else {
+            fprintf(stderr, "Usage: %s [-c main[+increment][/byoyomi[xperiods]] clock in seconds] "
+                            "[-j journal directory] [-s seconds between metrics dumps] "
+                            "[-v vote timeout in seconds] [-w worker threads]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cluster.count < 1) cluster.count = 1;
+
+    // Each connection holds a descriptor: allow as many as the hard limit permits
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    // A write to a vanished client must fail with EPIPE, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // One listening socket per worker on the same port: the kernel spreads the connections
+    cluster.workers = calloc(cluster.count, sizeof(Server));
+    for (int w = 0; w < cluster.count; w++) {
+        Server *server = &cluster.workers[w];
+        server->index = w;
+        server->cluster = &cluster;
+        server->vote_timeout_ms = vote_timeout_ms;
+        wheel_init(&server->wheel, now_ms());
+        server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+        struct sockaddr_in serv_addr = {AF_INET, htons(PORT), {INADDR_ANY}};
+        if (bind(server->listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+            log_text(LOG_ERROR, strerror(errno), "bind: %s");
+            return 1;
+        }
+        listen(server->listen_fd, SOMAXCONN);
+        fcntl(server->listen_fd, F_SETFL, O_NONBLOCK);
+
+        server->epoll_fd = epoll_create1(0);
+        struct epoll_event ev = {EPOLLIN, {.ptr = &server->listen_fd}};
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev);
+        server->inbox_fd = eventfd(0, EFD_NONBLOCK);
+        server->journal_fd = eventfd(0, 0);
+        if (w == 0) {
+            server->lobby = calloc(RULES_COUNT, sizeof(Lobby));
+            server->ratings = calloc(1, sizeof(RatingTable));
+            if (cluster.stats_ms) {
+                server->dumped = calloc(1, sizeof(MetricsSnapshot));
+                server->dump_ns = metrics_clock_ns();
+            }
+        }
+        ev.data.ptr = &server->inbox_fd;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->inbox_fd, &ev);
+    }
+
+    // Replay the journal, then append to a new segment of it
+    if (journal_dir) {
+        recover(&cluster, journal_dir);
+        cluster.journal = calloc(1, sizeof(Journal));
+        if (journal_open(cluster.journal, journal_dir) < 0) return 1;
+    }
+
+    // Engine threads for single-player rooms, shared by the workers
+    AiPool *ai = &cluster.ai;
+    pthread_mutex_init(&ai->lock, NULL);
+    pthread_cond_init(&ai->cond, NULL);
+    ai->cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ai->cores < 1) ai->cores = 1;
+    for (int i = 0; i < ai->cores; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, ai_thread, ai);
+        pthread_detach(tid);
+    }
+    log_info("Waiting for players on %d workers...", cluster.count);
+
+    // Worker 0 runs on the main thread
+    for (int w = 1; w < cluster.count; w++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, worker_loop, &cluster.workers[w]);
+        pthread_detach(tid);
+    }
+    worker_loop(&cluster.workers[0]);
     return 0;
 }
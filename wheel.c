@@ -0,0 +1,97 @@
+#include <stddef.h>
+#include "wheel.h"
+
+void wheel_init(Wheel *wheel, uint64_t now_ms) {
+    *wheel = (Wheel){0};
+    wheel->now = now_ms / WHEEL_TICK_MS;
+}
+
+static void link_timer(Wheel *wheel, Timer *timer) {
+    int level = 0;
+    // Lowest level where the expiry is less than a full turn of slots away
+    while (level < WHEEL_LEVELS - 1
+           && (timer->expires >> (level * WHEEL_BITS)) - (wheel->now >> (level * WHEEL_BITS)) >= WHEEL_SLOTS)
+        level++;
+    int slot = (timer->expires >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+    Timer **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+void wheel_add(Wheel *wheel, Timer *timer, uint64_t expires_ms) {
+    if (timer_armed(timer)) wheel_cancel(wheel, timer);
+    timer->expires = (expires_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    // Already due: fire on the next tick
+    if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+    link_timer(wheel, timer);
+}
+
+void wheel_cancel(Wheel *wheel, Timer *timer) {
+    if (!timer_armed(timer)) return;
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+    // The slot's bit is cleared lazily when the slot comes round empty
+}
+
+// Take a slot's whole list
+static Timer *take_slot(Wheel *wheel, int level, int slot) {
+    Timer *list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    return list;
+}
+
+Timer *wheel_advance(Wheel *wheel, uint64_t now_ms) {
+    uint64_t target = now_ms / WHEEL_TICK_MS;
+    Timer *expired = NULL;
+    // Nothing armed: the idle ticks need no walk
+    if (!(wheel->occupied[0] | wheel->occupied[1] | wheel->occupied[2] | wheel->occupied[3]) && wheel->now < target)
+        wheel->now = target;
+    while (wheel->now < target) {
+        wheel->now++;
+        // At the start of a turn of a level, the next slot of the level above moves down
+        for (int level = 1; level < WHEEL_LEVELS && !(wheel->now & ((1ULL << (level * WHEEL_BITS)) - 1)); level++) {
+            int slot = (wheel->now >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+            Timer *timer = take_slot(wheel, level, slot);
+            while (timer) {
+                Timer *next = timer->next;
+                link_timer(wheel, timer);
+                timer = next;
+            }
+        }
+        int slot = wheel->now & (WHEEL_SLOTS - 1);
+        if (!(wheel->occupied[0] & (1ULL << slot))) continue;
+        Timer *timer = take_slot(wheel, 0, slot);
+        while (timer) {
+            Timer *next = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+            timer = next;
+        }
+    }
+    return expired;
+}
+
+int wheel_next(const Wheel *wheel, uint64_t now_ms) {
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t bits = wheel->occupied[level];
+        if (!bits) continue;
+        int shift = level * WHEEL_BITS, current = (wheel->now >> shift) & (WHEEL_SLOTS - 1);
+        // Next occupied slot after the current one, going round
+        int from = (current + 1) & (WHEEL_SLOTS - 1);
+        uint64_t rotated = from ? bits >> from | bits << (WHEEL_SLOTS - from) : bits;
+        uint64_t distance = __builtin_ctzll(rotated) + 1;
+        // The slot is reached at the start of its span
+        uint64_t tick = ((wheel->now >> shift) + distance) << shift;
+        if (tick < best) best = tick;
+    }
+    if (best == UINT64_MAX) return -1;
+    uint64_t due = best * WHEEL_TICK_MS;
+    return due > now_ms ? (int)(due - now_ms) : 0;
+}
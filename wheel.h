@@ -0,0 +1,42 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timing wheel: WHEEL_LEVELS wheels of WHEEL_SLOTS slots, a slot of level n spans
+// WHEEL_SLOTS^n ticks. A timer sits in the lowest level whose range reaches its expiry and moves
+// down a level each time its slot comes round, so adding, cancelling and expiring a timer are
+// O(1) whatever the number of timers. 4 levels of 64 slots of 10 ms reach 46 hours.
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+typedef struct Timer {
+    uint64_t expires;                      // Tick
+    struct Timer *next, **pprev;           // pprev is NULL while the timer is not armed
+} Timer;
+
+typedef struct {
+    uint64_t now;                          // Last tick processed
+    uint64_t occupied[WHEEL_LEVELS];       // Bit per non-empty slot
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} Wheel;
+
+void wheel_init(Wheel *wheel, uint64_t now_ms);
+
+// Arm a timer for an absolute time in ms (rounded up to the next tick), re-arming it if it was armed
+void wheel_add(Wheel *wheel, Timer *timer, uint64_t expires_ms);
+
+void wheel_cancel(Wheel *wheel, Timer *timer);
+
+static inline int timer_armed(const Timer *timer) { return timer->pprev != 0; }
+
+// Process every tick up to now_ms and return the timers that expired, linked through next
+// and no longer armed
+Timer *wheel_advance(Wheel *wheel, uint64_t now_ms);
+
+// ms until the wheel has something to do, -1 if no timer is armed
+int wheel_next(const Wheel *wheel, uint64_t now_ms);
+
+#endif